@@ -0,0 +1,126 @@
+#include "account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "options.h"
+#include "visibility.h"
+
+#define ACCOUNTING_STDERR "stderr"
+#define NANOS_PER_SECOND 1000000000L
+#define MICROS_PER_SECOND 1000000L
+
+LINKAGE_PUBLIC void account_begin(Account* account, CommandLine* line) {
+	if (!line->timed && options.accounting == NULL) {
+		// Never reported, skip the syscalls
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &account->started);
+	getrusage(RUSAGE_SELF, &account->self);
+}
+
+LINKAGE_TRANSPARENT double timeval_seconds(struct timeval value) {
+	return value.tv_sec + (double) value.tv_usec / MICROS_PER_SECOND;
+}
+
+LINKAGE_PRIVATE double elapsed_seconds(struct timespec* from, struct timespec* to) {
+	return (to->tv_sec - from->tv_sec) + (double) (to->tv_nsec - from->tv_nsec) / NANOS_PER_SECOND;
+}
+
+// Same layout as the time keyword of bash, e.g. 0m1.250s
+LINKAGE_PRIVATE void print_duration(FILE* stream, const char* label, double seconds) {
+	long minutes = (long) (seconds / 60);
+	fprintf(stream, "%s\t%ldm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+LINKAGE_PRIVATE int exit_status(int status) {
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+LINKAGE_PRIVATE void print_usage(FILE* stream, const JobUsage* usage) {
+	fprintf(
+		stream,
+		"user=%.3f sys=%.3f maxrss=%ldk vcsw=%ld ivcsw=%ld",
+		timeval_seconds(usage->user),
+		timeval_seconds(usage->system),
+		usage->maxRss,
+		usage->voluntarySwitches,
+		usage->involuntarySwitches
+	);
+}
+
+LINKAGE_PRIVATE FILE* summary_stream() {
+	static FILE* stream = NULL;
+	if (stream == NULL) {
+		stream = strcmp(options.accounting, ACCOUNTING_STDERR) == 0 ? stderr : fopen(options.accounting, "ae");
+	}
+	return stream;
+}
+
+LINKAGE_PRIVATE void print_summary(FILE* stream, CommandLine* line, Job* job, double real, const JobUsage* total) {
+	char* description = job == NULL ? command_line_describe(line) : job->description;
+	fprintf(stream, "anubis: real=%.3f ", real);
+	print_usage(stream, total);
+	fprintf(stream, " line=%s\n", description == NULL ? "" : description);
+	if (job == NULL) {
+		free(description);
+	}
+	for (size_t i = 0; job != NULL && i < job->processCount; i++) {
+		JobProcess* process = &job->processes[i];
+		if (process->stage == STAGE_SUBSTITUTION) {
+			fprintf(stream, "anubis:   stage=substitution");
+		} else {
+			fprintf(stream, "anubis:   stage=%zu", process->stage);
+		}
+		fprintf(stream, " pid=%d status=%d ", process->pid, exit_status(process->status));
+		print_usage(stream, &process->usage);
+		Command* command = command_line_stage(line, process->stage);
+		if (command == NULL) {
+			// The relay feeding a fan-out's branches, or part of a process substitution
+			fprintf(stream, " command=%s", process->stage == STAGE_SUBSTITUTION ? "<(...)" : "|&");
+		} else {
+			fprintf(stream, " command=");
+			command_print(stream, command);
+		}
+		fprintf(stream, "\n");
+	}
+	fflush(stream);
+}
+
+LINKAGE_PUBLIC void account_end(Account* account, CommandLine* line, Job* job) {
+	if (!line->timed && options.accounting == NULL) {
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	JobUsage total = { 0 };
+	if (job != NULL) {
+		total = job->usage;
+	}
+	if (!line->bgOp) {
+		struct rusage self;
+		getrusage(RUSAGE_SELF, &self);
+		JobUsage shell = job_usage_from(&self);
+		timersub(&shell.user, &account->self.ru_utime, &shell.user);
+		timersub(&shell.system, &account->self.ru_stime, &shell.system);
+		shell.voluntarySwitches -= account->self.ru_nvcsw;
+		shell.involuntarySwitches -= account->self.ru_nivcsw;
+		// The shell's high water mark says nothing about this line
+		shell.maxRss = 0;
+		job_usage_add(&total, &shell);
+	}
+	struct timespec* finished = job != NULL && job->state == JOB_DONE ? &job->finished : &now;
+	double real = elapsed_seconds(&account->started, finished);
+	if (line->timed) {
+		fprintf(stderr, "\n");
+		print_duration(stderr, "real", real);
+		print_duration(stderr, "user", timeval_seconds(total.user));
+		print_duration(stderr, "sys", timeval_seconds(total.system));
+	}
+	FILE* stream;
+	if (options.accounting != NULL && (stream = summary_stream()) != NULL) {
+		print_summary(stream, line, job, real, &total);
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef ANUBIS_ACCOUNT_H
+#define ANUBIS_ACCOUNT_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "jobs.h"
+#include "structure.h"
+
+/* Resource accounting of command lines. Children are measured through the
+ * wait4 usage recorded on their job, work done by the shell itself (builtins
+ * and in-process utilities) through its own usage over the line.
+ */
+
+typedef struct Account {
+	struct timespec started;
+	struct rusage self;
+} Account;
+
+void account_begin(Account* account, CommandLine* line);
+/* Report a completed line, as time output on stderr if it was timed and to
+ * the summary (options.accounting) if enabled. The shell's own usage is only
+ * attributed to lines run in the foreground. job may be NULL.
+ */
+void account_end(Account* account, CommandLine* line, Job* job);
+
+#endif // ANUBIS_ACCOUNT_H
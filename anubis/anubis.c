@@ -3,95 +3,351 @@
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
-#include <sys/wait.h>
+#include <string.h>
 
 #include "error.h"
 #include "lexer.h"
 #include "parser.h"
 #include "executor.h"
 #include "structure.h"
+#include "arena.h"
 #include "path.h"
+#include "options.h"
+#include "jobs.h"
+#include "trace.h"
+#include "script_cache.h"
+#include "parse_ahead.h"
+#include "parse_parallel.h"
+#include "line_reader.h"
+#include "server.h"
+#include "zygote.h"
+#include "concurrent.h"
 #include "mem_utils.h"
 #include "checks.h"
 #include "visibility.h"
 
 #define INTERACTIVE 1
 #define BATCH 2
+// Script operand reading commands from stdin, without a prompt
+#define STDIN_OPERAND "-"
+// Exit status of a line that fails to parse, as in sh
+#define STATUS_SYNTAX 2
+
+// Runs one input line, returning its exit status. final: No input follows the line
+typedef int (*LineHandler)(char* line, bool final);
 
 static bool initialised = false;
 static Parser parser;
-static CommandTable* table = NULL;
-static Lexer* lexer = NULL;
+static Arena* arena = NULL;
+static Lexer lexer;
 static char* line = NULL;
+static LineReader reader = { 0 };
+static int serverSocket = -1;
+static int remoteStatus = 0;
 
 LINKAGE_PRIVATE void exit_handler(void) {
+	// Not a job, it would otherwise be waited on forever
+	zygote_stop();
+	// Output of lines still running is written out before anything else exits
+	concurrent_free();
 	// Wait for all child processes to exit
-	while (wait(NULL) >= 0);
+	jobs_wait_all();
+	jobs_free();
+	trace_dump();
 	// Clean up resources
-	command_table_free(table);
-	lexer_free(lexer);
+	arena_free(arena);
 	path_free();
 	checked_free(line);
+	line_reader_free(&reader);
 }
 
-LINKAGE_PRIVATE int shell_core(char* _line) {
+LINKAGE_PRIVATE int shell_init() {
 	if (!initialised) {
-		parser = parser_default();
+		if ((arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE)) == NULL) {
+			return 1;
+		}
+		parser = parser_default(arena);
 		initialised = true;
 	}
-	lexer_free(lexer);
-	lexer = lexer_new(_line);
-	command_table_free(table);
-	table = parse(&parser, lexer);
-	if (table == NULL) {
-		return 1;
+	// Releases the previous line's CommandTable in one go
+	arena_reset(arena);
+	return 0;
+}
+
+// Runs a parsed line, alongside the lines before it when they cannot interfere
+LINKAGE_PRIVATE void shell_execute(CommandTable* table, bool final) {
+	if (final) {
+		concurrent_drain();
+		execute_final(table);
+	} else if (!concurrent_execute(table)) {
+		execute(table);
+	}
+}
+
+// Deferred errors are raised after the output of the lines before them
+LINKAGE_PRIVATE void shell_replay(const ErrorSink* errors) {
+	if (errors->count > 0) {
+		concurrent_drain();
+		error_replay(errors);
 	}
+}
+
+/* Exit status of the line. The final line of a script may replace the shell
+ * instead, see execute_final(...)
+ */
+LINKAGE_PRIVATE int shell_core(char* _line, bool final) {
 	int ret;
+	transparent_return(shell_init());
+	// Lexed in place, the line buffer is not copied
+	lexer_reset(&lexer, _line);
+	// Kept back while lines run concurrently, their output comes first
+	ErrorSink sink = { .arena = arena };
+	ErrorSink* previous = concurrent_active() ? error_capture(&sink) : NULL;
+	uint64_t start = TRACE_BEGIN();
+	CommandTable* table = parse(&parser, &lexer);
+	TRACE_END(TRACE_PARSE, start);
+	if (concurrent_active()) {
+		error_capture(previous);
+		shell_replay(&sink);
+	}
+	if (table == NULL) {
+		// Reported as the line's status, by -c and - as much as by a script
+		execute_status_set(STATUS_SYNTAX);
+		return STATUS_SYNTAX;
+	}
 	//command_table_dump(table);
-	transparent_return(execute(table));
-	return 0;
+	shell_execute(table, final);
+	return execute_status();
+}
+
+// Server sessions keep running after each line, none of them is final
+LINKAGE_PRIVATE int shell_serve(char* _line) {
+	return shell_core(_line, false);
+}
+
+// Lines sent to a server (-C), the client exits with the status of the last one
+LINKAGE_PRIVATE int shell_remote(char* _line, bool final) {
+	(void) final;
+	int err = server_request(serverSocket, _line, &remoteStatus);
+	if (err == EPIPE) {
+		// The session has ended, as it does after exit
+		exit(remoteStatus);
+	} else if (err) {
+		ERROR(err, "Unable to run %s on the server", _line);
+		exit(1);
+	}
+	return remoteStatus;
 }
 
 LINKAGE_PRIVATE int next_line(char** _line, size_t* len, FILE* stream) {
 	if (stream == stdin) {
 		fprintf(stdout, "anubis> ");
 	}
-	return getline(_line, len, stream);
+	// Includes the time blocked on input, interactively that is the user typing
+	uint64_t start = TRACE_BEGIN();
+	int count = getline(_line, len, stream);
+	TRACE_END(TRACE_READ, start);
+	return count;
 }
 
-LINKAGE_PRIVATE int shell_stream(int mode, char* filename) {
-	FILE* stream = stdin;
-	if (mode == BATCH && (stream = fopen(filename, "r")) == NULL) {
-		ERROR(errno, "Unable to open file to stream");
-		return 1;
+// Runs a script from its compiled form, each line behaves as if read and parsed by shell_stream
+LINKAGE_PRIVATE int shell_compiled(CompiledScript* compiled) {
+	int ret;
+	for (size_t i = 0; i < compiled_script_lines(compiled); i++) {
+		transparent_return(shell_init());
+		ErrorSink errors;
+		uint64_t start = TRACE_BEGIN();
+		CommandTable* table = compiled_script_table(compiled, i, arena, &errors);
+		TRACE_END(TRACE_PARSE, start);
+		shell_replay(&errors);
+		if (table == NULL) {
+			execute_status_set(STATUS_SYNTAX);
+		} else {
+			shell_execute(table, i == compiled_script_lines(compiled) - 1);
+		}
 	}
+	// Unless the last line ran, lines before it may still be running
+	concurrent_drain();
+	return execute_status();
+}
+
+// true: Nothing but the end of the script is left to read
+LINKAGE_PRIVATE bool stream_ended(FILE* stream) {
+	int next = getc(stream);
+	if (next == EOF) {
+		return true;
+	}
+	ungetc(next, stream);
+	return false;
+}
+
+LINKAGE_PRIVATE void shell_lines(FILE* stream) {
 	checked_free(line);
 	line = NULL;
 	size_t len = 0;
 	ssize_t count = 0;
 	while ((count = next_line(&line, &len, stream)) > 0) {
 		if (line != NULL && len > 0) {
-			shell_core(line);
+			// Interactively the next line is whatever the user types, so none is final
+			shell_core(line, stream != stdin && stream_ended(stream));
 		}
 	}
+}
+
+// Runs a script parsed on a second thread, each line behaves as if read and parsed by shell_stream
+LINKAGE_PRIVATE int shell_ahead(ParseAhead* ahead) {
+	ParsedLine* parsed;
+	while ((parsed = parse_ahead_next(ahead)) != NULL) {
+		shell_replay(&parsed->errors);
+		if (parsed->table == NULL) {
+			execute_status_set(STATUS_SYNTAX);
+		} else {
+			shell_execute(parsed->table, false);
+		}
+	}
+	// No line is known to be the last one until it has run, it may still be running
+	concurrent_drain();
+	return execute_status();
+}
+
+// Runs a script parsed in parallel chunks, each line behaves as if read and parsed by shell_stream
+LINKAGE_PRIVATE int shell_parallel(ParallelScript* parallel) {
+	CommandTable* table;
+	ErrorSink errors;
+	while (parse_parallel_next(parallel, &table, &errors)) {
+		shell_replay(&errors);
+		if (table == NULL) {
+			execute_status_set(STATUS_SYNTAX);
+		} else {
+			shell_execute(table, false);
+		}
+	}
+	concurrent_drain();
+	return execute_status();
+}
+
+// Commands piped in (anubis -), read in bulk rather than prompted for line by line
+LINKAGE_PRIVATE int shell_reader(int fd, LineHandler handler) {
+	if (line_reader_init(&reader, fd, LINE_READER_DEFAULT_CAPACITY)) {
+		ERROR(ENOMEM, "Unable to allocate command stream buffer");
+		return 1;
+	}
+	char* _line;
+	ssize_t count;
+	while ((count = line_reader_next(&reader, &_line)) > 0) {
+		// A pipe can only be peeked by blocking on it, so lines streamed in are never final
+		handler(_line, false);
+	}
+	if (count < 0) {
+		ERROR(errno, "Unable to read command stream");
+	}
+	line_reader_free(&reader);
+	return count < 0;
+}
+
+// Commands given with -c, one per line of the (writable) argument
+LINKAGE_PRIVATE int shell_commands(char* commands, LineHandler handler) {
+	char* next;
+	for (char* at = commands; at != NULL; at = next) {
+		if ((next = strchr(at, '\n')) != NULL) {
+			*next++ = '\0';
+		}
+		handler(at, next == NULL);
+	}
+	return 0;
+}
+
+// Commands are read locally, from -c, the script or stdin, and run by the server
+LINKAGE_PRIVATE int shell_client(const char* socketPath, char* filename) {
+	if ((serverSocket = server_connect(socketPath)) == -1) {
+		ERROR(errno, "Unable to connect to %s", socketPath);
+		return 1;
+	} else if (options.commands != NULL) {
+		shell_commands(options.commands, shell_remote);
+		return remoteStatus;
+	}
+	int fd = STDIN_FILENO;
+	if (filename != NULL && strcmp(filename, STDIN_OPERAND) != 0 && (fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1) {
+		ERROR(errno, "Unable to open file to stream");
+		return 1;
+	}
+	return shell_reader(fd, shell_remote) ? 1 : remoteStatus;
+}
+
+LINKAGE_PRIVATE int shell_stream(int mode, char* filename) {
+	CompiledScript* compiled;
+	if (mode == BATCH && options.scriptCache != NULL && (compiled = script_cache_open(filename)) != NULL) {
+		int ret = shell_compiled(compiled);
+		script_cache_close(compiled);
+		return ret;
+	}
+	ParallelScript* parallel;
+	if (mode == BATCH && options.parseThreads > 0
+		&& (parallel = parse_parallel_open(filename, options.parseThreads, options.parseThreadsMinSize)) != NULL) {
+		int ret = shell_parallel(parallel);
+		parse_parallel_close(parallel);
+		return ret;
+	}
+	FILE* stream = stdin;
+	if (mode == BATCH && (stream = fopen(filename, "re")) == NULL) {
+		ERROR(errno, "Unable to open file to stream");
+		return 1;
+	}
+	ParseAhead* ahead;
+	if (mode == BATCH && options.parseAhead > 0 && (ahead = parse_ahead_start(stream, options.parseAhead)) != NULL) {
+		shell_ahead(ahead);
+		parse_ahead_stop(ahead);
+	} else {
+		shell_lines(stream);
+	}
 	if (mode == BATCH && fclose(stream)) {
 		ERROR(errno, "Unable to close stream");
 		return 1;
 	}
-	return 0;
+	concurrent_drain();
+	return execute_status();
 }
 
 LINKAGE_PUBLIC int main(int argc, char** argv) {
 	int ret;
 	transparent_return(atexit(exit_handler));
-	if (argc > 2) {
-		ERROR(EINVAL, "usage: anubis [script]");
+	if (options_init()) {
+		return 1;
+	}
+	int operand = options_parse_args(argc, argv);
+	if (operand < 0 || argc - operand > (options.commands == NULL && options.serve == NULL ? 1 : 0)
+		|| (options.serve != NULL && (options.connect != NULL || options.commands != NULL))) {
+		ERROR(EINVAL, OPTIONS_USAGE);
 		return 1;
 	}
+	if (options.spawnEngine == SPAWN_ENGINE_ZYGOTE) {
+		// Started before anything else is allocated, without one commands are spawned directly
+		zygote_start();
+	}
 	path_init();
-	transparent_return(shell_stream(
-		argc,
-		argc == BATCH ? argv[1] : NULL
-	));
+	if (options.serve != NULL) {
+		// Only returns once the server can no longer accept connections
+		ERROR(server_run(options.serve, shell_serve), "Unable to serve %s", options.serve);
+		return 1;
+	} else if (options.connect != NULL) {
+		return shell_client(options.connect, operand < argc ? argv[operand] : NULL);
+	} else if (options.commands != NULL) {
+		shell_commands(options.commands, shell_core);
+		return execute_status();
+	} else if (operand < argc && strcmp(argv[operand], STDIN_OPERAND) == 0) {
+		return shell_reader(STDIN_FILENO, shell_core) ? 1 : execute_status();
+	}
+	// Accounting and tracing happen in the shell, a line run in a copy of it would go unrecorded
+	if (operand < argc && options.parallelLines > 0 && options.accounting == NULL && !options.trace
+		&& concurrent_init(options.parallelLines)) {
+		// Still runs, one line after another
+		ERROR(ENOMEM, "Unable to allocate concurrent lines");
+	}
+	// Like sh, the exit status is that of the last line run
+	return shell_stream(
+		operand < argc ? BATCH : INTERACTIVE,
+		operand < argc ? argv[operand] : NULL
+	);
 }
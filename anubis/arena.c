@@ -0,0 +1,120 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "checks.h"
+#include "math_utils.h"
+#include "visibility.h"
+
+#define ALIGNMENT (sizeof(max_align_t))
+#define ALIGN_UP(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+#define BLOCK_DATA(block) ((char*) (block)->data)
+
+LINKAGE_PRIVATE ArenaBlock* block_new(size_t size) {
+	ArenaBlock* block = malloc(sizeof(*block) + size);
+	INSTANCE_NULL_CHECK_RETURN("ArenaBlock", block, NULL);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+LINKAGE_PUBLIC Arena* arena_new(size_t blockSize) {
+	Arena* arena = malloc(sizeof(*arena));
+	INSTANCE_NULL_CHECK_RETURN("Arena", arena, NULL);
+	arena->blockSize = blockSize;
+	if ((arena->head = block_new(blockSize)) == NULL) {
+		free(arena);
+		return NULL;
+	}
+	arena->current = arena->head;
+	return arena;
+}
+
+LINKAGE_PUBLIC void arena_free(Arena* arena) {
+	if (arena == NULL) {
+		// Invoked in shutdown hook, ignore null entries as they are already free
+		return;
+	}
+	ArenaBlock* block = arena->head;
+	while (block != NULL) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(arena);
+}
+
+LINKAGE_PUBLIC void arena_reset(Arena* arena) {
+	INSTANCE_NULL_CHECK("Arena", arena);
+	// Later blocks are reset lazily as allocation advances into them
+	arena->current = arena->head;
+	arena->current->used = 0;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC void* arena_alloc(Arena* arena, size_t size) {
+	INSTANCE_NULL_CHECK_RETURN("Arena", arena, NULL);
+	size = ALIGN_UP(MAX(size, (size_t) 1));
+	ArenaBlock* block = arena->current;
+	while (block->used + size > block->size) {
+		if (block->next == NULL || block->next->size < size) {
+			// Splice a fresh block in after the current one, retained across resets
+			ArenaBlock* fresh = block_new(MAX(arena->blockSize, size));
+			if (fresh == NULL) {
+				return NULL;
+			}
+			fresh->next = block->next;
+			block->next = fresh;
+		}
+		block = block->next;
+		block->used = 0;
+	}
+	arena->current = block;
+	void* ptr = BLOCK_DATA(block) + block->used;
+	block->used += size;
+	return ptr;
+}
+
+LINKAGE_PUBLIC void* arena_calloc(Arena* arena, size_t count, size_t size) {
+	void* ptr = arena_alloc(arena, count * size);
+	if (ptr != NULL) {
+		memset(ptr, 0, count * size);
+	}
+	return ptr;
+}
+
+LINKAGE_PUBLIC void* arena_realloc(Arena* arena, void* ptr, size_t oldSize, size_t newSize) {
+	if (ptr == NULL) {
+		return arena_alloc(arena, newSize);
+	}
+	ArenaBlock* block = arena->current;
+	size_t offset = (char*) ptr - BLOCK_DATA(block);
+	if ((uintptr_t) ptr >= (uintptr_t) BLOCK_DATA(block)
+		&& offset + ALIGN_UP(oldSize) == block->used
+		&& offset + ALIGN_UP(newSize) <= block->size) {
+		// Most recent allocation, extend it in place
+		block->used = offset + ALIGN_UP(newSize);
+		return ptr;
+	}
+	void* moved = arena_alloc(arena, newSize);
+	if (moved != NULL) {
+		memcpy(moved, ptr, MIN(oldSize, newSize));
+	}
+	return moved;
+}
+
+LINKAGE_PUBLIC char* arena_strndup(Arena* arena, const char* str, size_t len) {
+	char* copy = arena_alloc(arena, len + 1);
+	if (copy != NULL) {
+		memcpy(copy, str, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+LINKAGE_PUBLIC char* arena_strdup(Arena* arena, const char* str) {
+	return arena_strndup(arena, str, strlen(str));
+}
@@ -0,0 +1,35 @@
+#ifndef ANUBIS_ARENA_H
+#define ANUBIS_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE 8192
+
+/* Bump allocator, individual allocations are never freed. Everything is
+ * released at once by arena_reset(...), which keeps the blocks for reuse.
+ */
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} ArenaBlock;
+
+typedef struct Arena {
+	size_t blockSize;
+	ArenaBlock* head;
+	ArenaBlock* current;
+} Arena;
+
+Arena* arena_new(size_t blockSize);
+void arena_free(Arena* arena);
+void arena_reset(Arena* arena);
+
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+// Grows in place when ptr is the most recent allocation, otherwise copies
+void* arena_realloc(Arena* arena, void* ptr, size_t oldSize, size_t newSize);
+char* arena_strdup(Arena* arena, const char* str);
+char* arena_strndup(Arena* arena, const char* str, size_t len);
+
+#endif // ANUBIS_ARENA_H
@@ -0,0 +1,86 @@
+#! /usr/bin/env bash
+
+# End to end benchmark: generates batch scripts for a few workloads, runs each
+# RUNS times under anubis (and dash/bash with BENCH_COMPARE=1, when installed)
+# and prints wall time percentiles and lines per second as JSON.
+#
+# usage: e2e.sh [anubis binary]
+#   RUNS=5  runs per workload and shell
+#   LINES=2000  lines in the pipeline workload, the others scale from it
+#   BENCH_COMPARE=0|1  also run the scripts under dash and bash
+
+ANUBIS=${1:-./anubis}
+RUNS=${RUNS:-5}
+LINES=${LINES:-2000}
+BENCH_COMPARE=${BENCH_COMPARE:-0}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# generate name count line...: repeats the line count times into $workdir/name
+generate () {
+    local name=$1
+    local count=$2
+    local line=$3
+    for (( i = 0; i < count; i++ )); do
+	echo "$line"
+    done > "$workdir/$name"
+    echo "exit" >> "$workdir/$name"
+}
+
+long_args=$(printf 'argument%d ' $(seq 1 500))
+deep_pipeline="echo deep$(printf ' | cat%.0s' $(seq 1 20)) | wc -c"
+
+generate pipelines $LINES "echo hello,world | cat | wc -c"
+generate long_args $(( LINES / 10 )) "echo $long_args"
+generate deep_pipeline $(( LINES / 20 )) "$deep_pipeline"
+generate background $(( LINES / 4 )) "true & true & true & true & wait"
+workloads="pipelines long_args deep_pipeline background"
+
+shells="$ANUBIS"
+if (( BENCH_COMPARE == 1 )); then
+    for shell in dash bash; do
+	if command -v $shell > /dev/null; then
+	    shells="$shells $(command -v $shell)"
+	fi
+    done
+fi
+
+# measure shell script: prints RUNS wall times in milliseconds, one per line
+measure () {
+    local shell=$1
+    local script=$2
+    for (( run = 0; run < RUNS; run++ )); do
+	local start=$(date +%s%N)
+	$shell "$script" > /dev/null 2>&1
+	local end=$(date +%s%N)
+	awk -v s=$start -v e=$end 'BEGIN { printf "%.3f\n", (e - s) / 1000000 }'
+    done
+}
+
+echo "{\"runs\": $RUNS, \"workloads\": ["
+first_workload=1
+for workload in $workloads; do
+    script="$workdir/$workload"
+    lines=$(( $(wc -l < "$script") - 1 ))
+    (( first_workload )) || echo ","
+    first_workload=0
+    echo "  {\"name\": \"$workload\", \"lines\": $lines, \"shells\": ["
+    first_shell=1
+    for shell in $shells; do
+	(( first_shell )) || echo ","
+	first_shell=0
+	measure "$shell" "$script" | sort -n | awk -v shell="$(basename "$shell")" -v lines=$lines '
+	    { t[NR] = $1; sum += $1 }
+	    END {
+		mean = sum / NR
+		p50 = t[int(0.5 * (NR - 1) + 1.5)]
+		p95 = t[int(0.95 * (NR - 1) + 1.5)]
+		printf "    {\"shell\": \"%s\", \"ms\": {\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f}, \"lines_per_sec\": %.1f}", shell, t[1], mean, p50, p95, t[NR], lines / (mean / 1000)
+	    }'
+    done
+    echo ""
+    echo -n "  ]}"
+done
+echo ""
+echo "]}"
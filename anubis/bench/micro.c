@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+/* Microbenchmarks of the shell's hot path, linked against its objects.
+ * Each benchmark times SAMPLES batches of BATCH operations and reports the
+ * throughput and the per operation latency percentiles across batches as JSON.
+ *
+ * usage: micro [filter]  (only benchmarks whose name contains filter)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "arena.h"
+#include "lexer.h"
+#include "math_utils.h"
+#include "options.h"
+#include "parser.h"
+#include "path.h"
+#include "path_cache.h"
+#include "spawn.h"
+#include "structure.h"
+#include "zygote.h"
+
+#define SAMPLES 200
+#define NANOS_PER_SECOND 1e9
+// Memory the shell is grown by before the *_grown spawns, to show fork cost scaling with it
+#define BALLAST_SIZE (256 << 20)
+// Arguments of the *_long line, cycling through plain, quoted and escaped words
+#define LONG_LINE_ARGS 8192
+
+typedef void (*BenchOp)(void* context);
+
+typedef struct Bench {
+	const char* name;
+	BenchOp op;
+	size_t batch;
+} Bench;
+
+static const char* benchLine = "echo \"hello world\" 'quoted | text' | cat -n | wc -l > /dev/null &";
+static char lineBuffer[256];
+static const char* longWords[] = { "argument%d", "\"quoted word %d\"", "'single %d'", "escaped\\ %d" };
+// Long plain runs, where the delimiter scan rather than the per token costs dominates
+static const char* pathWords[] = { "/usr/local/share/anubis/some/deeply/nested/directory/file_%d.txt" };
+static char* longLine = NULL;
+static size_t longLineSize = 0;
+static char* pathLine = NULL;
+static size_t pathLineSize = 0;
+static char* longLineBuffer = NULL;
+static Arena* arena;
+static Parser parser;
+static Lexer lexer;
+static char* spawnArgs[] = { "/bin/true", NULL };
+static char* ballast = NULL;
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * NANOS_PER_SECOND + time.tv_nsec;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(double* sorted, size_t count, double p) {
+	size_t index = (size_t) (p * (count - 1) + 0.5);
+	return sorted[index];
+}
+
+// The lexer rewrites its source in place, so every operation lexes a fresh copy
+static void op_lex(void* context) {
+	strcpy(lineBuffer, benchLine);
+	lexer_reset(&lexer, lineBuffer);
+	while (lexer_next_symbol(&lexer));
+}
+
+static void op_parse(void* context) {
+	strcpy(lineBuffer, benchLine);
+	arena_reset(arena);
+	lexer_reset(&lexer, lineBuffer);
+	if (parse(&parser, &lexer) == NULL) {
+		exit(1);
+	}
+}
+
+// echo followed by LONG_LINE_ARGS words cycling through the formats, where per token costs (copies, list growth) dominate
+static int build_long_line(char** line, size_t* size, const char** words, size_t count) {
+	FILE* stream = open_memstream(line, size);
+	if (stream == NULL) {
+		return 1;
+	}
+	fputs("echo", stream);
+	for (int i = 0; i < LONG_LINE_ARGS; i++) {
+		fputc(' ', stream);
+		fprintf(stream, words[i % count], i);
+	}
+	return fclose(stream);
+}
+
+static int build_long_lines() {
+	if (
+		build_long_line(&longLine, &longLineSize, longWords, sizeof(longWords) / sizeof(*longWords))
+		|| build_long_line(&pathLine, &pathLineSize, pathWords, sizeof(pathWords) / sizeof(*pathWords))
+	) {
+		return 1;
+	}
+	longLineBuffer = malloc(MAX(longLineSize, pathLineSize) + 1);
+	return longLineBuffer == NULL;
+}
+
+static void op_lex_long(void* context) {
+	memcpy(longLineBuffer, longLine, longLineSize + 1);
+	lexer_reset(&lexer, longLineBuffer);
+	while (lexer_next_symbol(&lexer));
+}
+
+static void op_lex_paths(void* context) {
+	memcpy(longLineBuffer, pathLine, pathLineSize + 1);
+	lexer_reset(&lexer, longLineBuffer);
+	while (lexer_next_symbol(&lexer));
+}
+
+static void op_parse_long(void* context) {
+	memcpy(longLineBuffer, longLine, longLineSize + 1);
+	arena_reset(arena);
+	lexer_reset(&lexer, longLineBuffer);
+	if (parse(&parser, &lexer) == NULL) {
+		exit(1);
+	}
+}
+
+static void op_resolve_cached(void* context) {
+	free(path_resolve("ls"));
+}
+
+static void op_resolve_cold(void* context) {
+	path_cache_flush();
+	free(path_resolve("ls"));
+}
+
+static void spawn_and_wait(SpawnEngine engine) {
+	options.spawnEngine = engine;
+	IO io = { STDIN_FILENO, STDOUT_FILENO };
+	pid_t pid;
+	if (spawn_command(spawnArgs[0], spawnArgs, &io, &pid) != 0) {
+		exit(1);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+static void op_spawn_posix(void* context) {
+	spawn_and_wait(SPAWN_ENGINE_POSIX);
+}
+
+static void op_spawn_fork(void* context) {
+	spawn_and_wait(SPAWN_ENGINE_FORK);
+}
+
+static void op_spawn_zygote(void* context) {
+	spawn_and_wait(SPAWN_ENGINE_ZYGOTE);
+}
+
+// Touched so every page is mapped and has to be copied or shared by fork
+static void grow() {
+	if (ballast == NULL && (ballast = malloc(BALLAST_SIZE)) != NULL) {
+		memset(ballast, 1, BALLAST_SIZE);
+	}
+}
+
+static void op_spawn_posix_grown(void* context) {
+	grow();
+	spawn_and_wait(SPAWN_ENGINE_POSIX);
+}
+
+static void op_spawn_fork_grown(void* context) {
+	grow();
+	spawn_and_wait(SPAWN_ENGINE_FORK);
+}
+
+static void op_spawn_zygote_grown(void* context) {
+	grow();
+	spawn_and_wait(SPAWN_ENGINE_ZYGOTE);
+}
+
+static int task_exit(void* context, IO* io) {
+	return 0;
+}
+
+static void op_spawn_task(void* context) {
+	IO io = { STDIN_FILENO, STDOUT_FILENO };
+	pid_t pid;
+	if (spawn_task(task_exit, NULL, &io, -1, &pid) != 0) {
+		exit(1);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+static Bench benches[] = {
+	{ "lexer_next_symbol", op_lex, 10000 },
+	{ "parse", op_parse, 10000 },
+	{ "lexer_next_symbol_long", op_lex_long, 10 },
+	{ "lexer_next_symbol_paths", op_lex_paths, 10 },
+	{ "parse_long", op_parse_long, 10 },
+	{ "path_resolve_cached", op_resolve_cached, 10000 },
+	{ "path_resolve_cold", op_resolve_cold, 1000 },
+	{ "spawn_posix", op_spawn_posix, 10 },
+	{ "spawn_fork", op_spawn_fork, 10 },
+	{ "spawn_task", op_spawn_task, 10 },
+	{ "spawn_zygote", op_spawn_zygote, 10 },
+	{ "spawn_posix_grown", op_spawn_posix_grown, 10 },
+	{ "spawn_fork_grown", op_spawn_fork_grown, 10 },
+	{ "spawn_zygote_grown", op_spawn_zygote_grown, 10 },
+};
+
+static void run(Bench* bench, bool first) {
+	static double samples[SAMPLES];
+	double total = 0;
+	// Warm up caches and the allocator before measuring
+	for (size_t i = 0; i < bench->batch; i++) {
+		bench->op(NULL);
+	}
+	for (size_t s = 0; s < SAMPLES; s++) {
+		double start = now();
+		for (size_t i = 0; i < bench->batch; i++) {
+			bench->op(NULL);
+		}
+		double elapsed = now() - start;
+		total += elapsed;
+		samples[s] = elapsed / bench->batch;
+	}
+	qsort(samples, SAMPLES, sizeof(*samples), compare_doubles);
+	printf(
+		"%s\n    {\"name\": \"%s\", \"ops\": %zu, \"ops_per_sec\": %.1f, \"ns_per_op\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}",
+		first ? "" : ",",
+		bench->name,
+		(size_t) SAMPLES * bench->batch,
+		SAMPLES * bench->batch * NANOS_PER_SECOND / total,
+		samples[0],
+		percentile(samples, SAMPLES, 0.5),
+		percentile(samples, SAMPLES, 0.9),
+		percentile(samples, SAMPLES, 0.99),
+		samples[SAMPLES - 1]
+	);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	char* filter = argc > 1 ? argv[1] : NULL;
+	// Before anything is allocated, as the shell does
+	if (options_init() || zygote_start() || path_init()) {
+		return 1;
+	}
+	char* dirs[] = { "/usr/local/bin", "/usr/bin" };
+	path_add(dirs, sizeof(dirs) / sizeof(*dirs));
+	if ((arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE)) == NULL || build_long_lines()) {
+		return 1;
+	}
+	parser = parser_default(arena);
+	printf("{\"line\": \"");
+	for (const char* c = benchLine; *c != '\0'; c++) {
+		printf(*c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+	}
+	printf("\", \"samples\": %d, \"benchmarks\": [", SAMPLES);
+	bool first = true;
+	for (size_t i = 0; i < sizeof(benches) / sizeof(*benches); i++) {
+		if (filter == NULL || strstr(benches[i].name, filter) != NULL) {
+			run(&benches[i], first);
+			first = false;
+		}
+	}
+	printf("\n]}\n");
+	arena_free(arena);
+	free(longLine);
+	free(pathLine);
+	free(longLineBuffer);
+	path_free();
+	zygote_stop();
+	free(ballast);
+	return 0;
+}
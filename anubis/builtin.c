@@ -1,22 +1,39 @@
 #include "builtin.h"
 
+#include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "error.h"
 #include "path.h"
+#include "path_cache.h"
+#include "jobs.h"
+#include "options.h"
+#include "pool.h"
+#include "spawn.h"
+#include "zygote.h"
+#include "utility.h"
 #include "visibility.h"
 
 // NOTE: This is in alphabetical order to allow for binary search over commands
 BuiltIn built_in_commands[] = {
+	{"bg", builtin_bg},
 	{"cd", builtin_cd},
+	{"enable", builtin_enable},
+	{"exec", builtin_exec},
 	{"exit", builtin_exit},
+	{"fg", builtin_fg},
+	{"hash", builtin_hash},
+	{"jobs", builtin_jobs},
+	{"parallel", builtin_parallel, true},
 	{"path", builtin_path},
+	{"wait", builtin_wait},
 	{NULL, NULL}
 }; // TODO: Allow programmatic abitrary registration of commands
 
-size_t built_in_commands_size = 3;
+size_t built_in_commands_size = sizeof(built_in_commands) / sizeof(*built_in_commands) - 1;
 
 LINKAGE_PUBLIC int builtin_cd(char** args, size_t argCount) {
 	if (argCount == 0 || argCount > 1) {
@@ -28,6 +45,45 @@ LINKAGE_PUBLIC int builtin_cd(char** args, size_t argCount) {
 	return 0;
 }
 
+// enable [-n] [utility ...], toggles the in-process implementation of each utility
+LINKAGE_PUBLIC int builtin_enable(char** args, size_t argCount) {
+	if (argCount == 0) {
+		for (size_t i = 0; i < utilities_size; i++) {
+			fprintf(stdout, "enable %s%s\n", utilities[i].enabled ? "" : "-n ", utilities[i].name);
+		}
+		fflush(stdout);
+		return 0;
+	}
+	bool enabled = strcmp(args[0], "-n") != 0;
+	size_t first = enabled ? 0 : 1;
+	if (first == argCount) {
+		return EINVAL;
+	}
+	int ret;
+	for (size_t i = first; i < argCount; i++) {
+		if ((ret = utility_set_enabled(args[i], enabled)) != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// exec command [arg ...], replaces the shell with the command
+LINKAGE_PUBLIC int builtin_exec(char** args, size_t argCount) {
+	if (argCount == 0) {
+		return EINVAL;
+	}
+	char* resolved = path_resolve(args[0]);
+	if (resolved == NULL) {
+		return ENOENT;
+	}
+	// Its socket would close on exec anyway, stopping it here leaves no zombie behind
+	zygote_stop();
+	int err = spawn_replace(resolved, args);
+	free(resolved);
+	return err;
+}
+
 LINKAGE_PUBLIC int builtin_exit(char** args, size_t argCount) {
 	if (argCount > 0) {
 		return EINVAL;
@@ -36,6 +92,151 @@ LINKAGE_PUBLIC int builtin_exit(char** args, size_t argCount) {
 	__builtin_unreachable();
 }
 
+LINKAGE_PRIVATE void print_hash_entry(const PathCacheEntry* entry) {
+	fprintf(stdout, "%4zu\t%s\n", entry->hits, entry->resolved);
+}
+
+LINKAGE_PUBLIC int builtin_hash(char** args, size_t argCount) {
+	if (argCount == 0) {
+		if (path_cache_size() > 0) {
+			fprintf(stdout, "hits\tcommand\n");
+			path_cache_foreach(print_hash_entry);
+		}
+		// Output is redirected per command, flush before the descriptors are restored
+		fflush(stdout);
+		return 0;
+	} else if (strcmp(args[0], "-r") == 0) {
+		if (argCount > 1) {
+			return EINVAL;
+		}
+		path_cache_flush();
+		return 0;
+	}
+	int ret;
+	for (size_t i = 0; i < argCount; i++) {
+		if ((ret = path_rehash(args[i])) != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// Accepts both N and %N forms of a job id
+LINKAGE_PRIVATE Job* find_job(char* arg) {
+	char* end;
+	long id = strtol(arg[0] == '%' ? &arg[1] : arg, &end, 10);
+	if (*end != '\0' || end == arg) {
+		return NULL;
+	}
+	return jobs_find((int) id);
+}
+
+LINKAGE_PRIVATE Job* target_job(char** args, size_t argCount) {
+	if (argCount > 1) {
+		return NULL;
+	}
+	return argCount == 0 ? jobs_current() : find_job(args[0]);
+}
+
+LINKAGE_PUBLIC int builtin_jobs(char** args, size_t argCount) {
+	if (argCount == 0) {
+		jobs_report();
+		return 0;
+	} else if (strcmp(args[0], "-j") != 0 || argCount > 2) {
+		return EINVAL;
+	} else if (argCount == 1) {
+		fprintf(stdout, "%zu\n", options.jobLimit);
+		fflush(stdout);
+		return 0;
+	}
+	size_t limit = options_parse_count(args[1]);
+	if (limit == 0) {
+		return EINVAL;
+	}
+	options.jobLimit = limit;
+	return 0;
+}
+
+LINKAGE_PUBLIC int builtin_wait(char** args, size_t argCount) {
+	if (argCount == 0) {
+		return jobs_wait_all();
+	}
+	for (size_t i = 0; i < argCount; i++) {
+		Job* job = find_job(args[i]);
+		if (job == NULL) {
+			return ESRCH;
+		}
+		job_wait(job);
+		if (job->state == JOB_DONE) {
+			job_remove(job);
+		}
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC int builtin_fg(char** args, size_t argCount) {
+	Job* job = target_job(args, argCount);
+	if (job == NULL) {
+		return ESRCH;
+	}
+	int ret;
+	if ((ret = job_continue(job, false)) != 0) {
+		return ret;
+	}
+	job_wait(job);
+	if (job->state == JOB_DONE) {
+		job_remove(job);
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC int builtin_bg(char** args, size_t argCount) {
+	Job* job = target_job(args, argCount);
+	if (job == NULL) {
+		return ESRCH;
+	}
+	return job_continue(job, true);
+}
+
+// parallel [-j jobs] [-k] command [arg ...] [::: input ...], runs command once per input (or line of stdin)
+LINKAGE_PUBLIC int builtin_parallel(char** args, size_t argCount) {
+	PoolTemplate template = { .width = options.jobLimit };
+	size_t first = 0;
+	for (; first < argCount && args[first][0] == '-'; first++) {
+		if (strcmp(args[first], "-k") == 0) {
+			template.keepOrder = true;
+		} else if (strcmp(args[first], "-j") != 0 || first + 1 == argCount
+			|| (template.width = options_parse_count(args[++first])) == 0) {
+			return EINVAL;
+		}
+	}
+	char** inputs = NULL;
+	size_t inputCount = 0;
+	size_t separator = first;
+	while (separator < argCount && strcmp(args[separator], POOL_INPUT_SEPARATOR) != 0) {
+		separator++;
+	}
+	if (separator == first) {
+		return EINVAL;
+	}
+	char* marker = args[separator];
+	if (separator < argCount) {
+		// The template ends at the separator, restored for whoever reads the line next
+		args[separator] = NULL;
+		inputs = &args[separator + 1];
+		inputCount = argCount - separator - 1;
+	}
+	template.args = &args[first];
+	int err = ENOENT;
+	bool failed = false;
+	if ((template.resolved = path_resolve(args[first])) != NULL) {
+		err = pool_run(&template, inputs, inputCount, &failed);
+		free(template.resolved);
+	}
+	args[separator] = marker;
+	return err == 0 && failed ? BUILTIN_FAILED : err;
+}
+
 LINKAGE_PUBLIC int builtin_path(char** args, size_t argCount) {
 	if (argCount == 0) {
 		path_clear();
@@ -48,7 +249,7 @@ LINKAGE_PUBLIC int builtin_path(char** args, size_t argCount) {
 	return 0;
 }
 
-LINKAGE_PRIVATE BuiltIn* builtin_binary_search(char* command) {
+LINKAGE_PUBLIC BuiltIn* builtin_lookup(char* command) {
 	int lower = 0;
 	int mid;
 	int upper = built_in_commands_size - 1;
@@ -69,7 +270,7 @@ LINKAGE_PRIVATE BuiltIn* builtin_binary_search(char* command) {
 }
 
 LINKAGE_PUBLIC int builtin_execv(char* command, char** args, size_t argCount) {
-	BuiltIn* cmd = builtin_binary_search(command);
+	BuiltIn* cmd = builtin_lookup(command);
 	if (cmd != NULL) {
 		return cmd->command(args, argCount);
 	}
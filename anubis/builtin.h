@@ -2,20 +2,37 @@
 #define ANUBIS_BUILTIN_H
 
 #include <stddef.h>
+#include <stdbool.h>
+
+// Returned by a builtin that ran, but whose own commands did not all succeed (exit status 1, nothing to report)
+#define BUILTIN_FAILED -2
 
 typedef int (*BuiltinCmd)(char**, size_t);
 
 typedef struct BuiltIn {
 	const char *name;
 	BuiltinCmd command;
+	// Streams the output of commands of its own, forked as a task unless it is the last stage
+	bool task;
 } BuiltIn;
 
 extern BuiltIn built_in_commands[];
 extern size_t built_in_commands_size;
 
+int builtin_bg(char** args, size_t argCount);
 int builtin_cd(char** args, size_t argCount);
+int builtin_enable(char** args, size_t argCount);
+int builtin_exec(char** args, size_t argCount);
 int builtin_exit(char** args, size_t argCount);
+int builtin_fg(char** args, size_t argCount);
+int builtin_hash(char** args, size_t argCount);
+int builtin_jobs(char** args, size_t argCount);
+int builtin_parallel(char** args, size_t argCount);
 int builtin_path(char** args, size_t argCount);
+int builtin_wait(char** args, size_t argCount);
+
+// NULL: No matching command, Otherwise: the registered builtin
+BuiltIn* builtin_lookup(char* command);
 
 // -1: No matching command, Otherwise: command found and executed with return value
 int builtin_execv(char* command, char** args, size_t argCount);
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+
+#include "concurrent.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "arena.h"
+#include "builtin.h"
+#include "executor.h"
+#include "jobs.h"
+#include "relay.h"
+#include "zygote.h"
+#include "visibility.h"
+
+#define FAIL_COND -1
+// Footprints are a few paths per line, the first block is usually the only one
+#define FOOTPRINT_BLOCK_SIZE 4096
+
+typedef struct LineSlot {
+	// 0: Untracked, pid is waited on directly
+	int jobId;
+	pid_t pid;
+	// Captured stdout and stderr
+	int out;
+	int err;
+	// Owns the footprint, reset for each line started in the slot
+	Arena* arena;
+	char** paths;
+	// false: Only read, as a command is
+	bool* written;
+	size_t pathCount;
+} LineSlot;
+
+// Ring of the lines running, oldest first from head
+static LineSlot* slots = NULL;
+static size_t slotCount = 0;
+static size_t head = 0;
+static size_t running = 0;
+
+LINKAGE_PUBLIC int concurrent_init(size_t count) {
+	if ((slots = calloc(count, sizeof(*slots))) == NULL) {
+		return ENOMEM;
+	}
+	slotCount = count;
+	return 0;
+}
+
+LINKAGE_PUBLIC void concurrent_free() {
+	if (slots == NULL) {
+		return;
+	}
+	concurrent_drain();
+	for (size_t i = 0; i < slotCount; i++) {
+		arena_free(slots[i].arena);
+	}
+	free(slots);
+	slots = NULL;
+	slotCount = 0;
+}
+
+LINKAGE_PUBLIC bool concurrent_active() {
+	return slots != NULL;
+}
+
+/* Builtins change the shell itself and a line ending in & leaves jobs in its
+ * table. The commands of process substitutions are not part of the footprint.
+ */
+LINKAGE_PRIVATE bool is_barrier(CommandTable* table) {
+	if (table->lineCount > 0 && table->lines[table->lineCount - 1]->bgOp) {
+		return true;
+	}
+	for (size_t i = 0; i < table->lineCount; i++) {
+		CommandLine* line = table->lines[i];
+		for (size_t j = 0; j < line->pipeCount + line->branchCount; j++) {
+			Command* command = command_line_stage(line, j);
+			if (builtin_lookup(command->command) != NULL || command->substitutionCount > 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/* Absolute form of path with . and .. removed, without consulting the file
+ * system (cd is a barrier, so cwd holds for every running line). The root is
+ * the empty string, so that it is a directory prefix of every other path.
+ */
+LINKAGE_PRIVATE char* normalise_path(Arena* arena, const char* cwd, const char* path) {
+	size_t cwdLength = path[0] == '/' ? 0 : strlen(cwd);
+	char* joined = arena_alloc(arena, cwdLength + strlen(path) + 2);
+	if (joined == NULL) {
+		return NULL;
+	}
+	memcpy(joined, cwd, cwdLength);
+	joined[cwdLength] = '/';
+	strcpy(joined + cwdLength + 1, path);
+	// Rewritten in place, the result is never longer than what has been read
+	size_t length = 0;
+	for (char* component = joined; *component != '\0';) {
+		char* end = strchrnul(component, '/');
+		size_t size = end - component;
+		if (size == 2 && component[0] == '.' && component[1] == '.') {
+			while (length > 0 && joined[--length] != '/');
+		} else if (size > 0 && !(size == 1 && component[0] == '.')) {
+			joined[length++] = '/';
+			memmove(joined + length, component, size);
+			length += size;
+		}
+		component = *end == '\0' ? end : end + 1;
+	}
+	joined[length] = '\0';
+	return joined;
+}
+
+// Words of the line that may name a file, options only for the value after an =
+LINKAGE_PRIVATE const char* footprint_word(const char* word, bool isCommand) {
+	if (isCommand) {
+		return strchr(word, '/') != NULL ? word : NULL;
+	} else if (word[0] != '-') {
+		return word;
+	}
+	const char* value = strchr(word, '=');
+	return value != NULL && value[1] != '\0' ? value + 1 : NULL;
+}
+
+// 0: The slot holds the line's footprint, Otherwise: errno
+LINKAGE_PRIVATE int footprint_collect(LineSlot* slot, CommandTable* table) {
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		return errno;
+	}
+	if (slot->arena == NULL && (slot->arena = arena_new(FOOTPRINT_BLOCK_SIZE)) == NULL) {
+		return ENOMEM;
+	}
+	arena_reset(slot->arena);
+	size_t capacity = 0;
+	for (size_t i = 0; i < table->lineCount; i++) {
+		CommandLine* line = table->lines[i];
+		for (size_t j = 0; j < line->pipeCount + line->branchCount; j++) {
+			capacity += command_line_stage(line, j)->argCount;
+		}
+		capacity++;
+	}
+	if ((slot->paths = arena_alloc(slot->arena, capacity * sizeof(*slot->paths))) == NULL
+		|| (slot->written = arena_alloc(slot->arena, capacity * sizeof(*slot->written))) == NULL) {
+		return ENOMEM;
+	}
+	slot->pathCount = 0;
+	for (size_t i = 0; i < table->lineCount; i++) {
+		CommandLine* line = table->lines[i];
+		for (size_t j = 0; j < line->pipeCount + line->branchCount; j++) {
+			Args args = command_line_stage(line, j)->args;
+			for (size_t k = 0; args[k] != NULL; k++) {
+				const char* word = footprint_word(args[k], k == 0);
+				if (word == NULL) {
+					continue;
+				}
+				slot->written[slot->pathCount] = k > 0;
+				if ((slot->paths[slot->pathCount++] = normalise_path(slot->arena, cwd, word)) == NULL) {
+					return ENOMEM;
+				}
+			}
+		}
+		char* outfile = line->ioModifiers->outTrunc;
+		if (outfile == NULL) {
+			continue;
+		}
+		slot->written[slot->pathCount] = true;
+		if ((slot->paths[slot->pathCount++] = normalise_path(slot->arena, cwd, outfile)) == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
+// true: One is the other, or a directory holding it
+LINKAGE_PRIVATE bool paths_overlap(const char* a, const char* b) {
+	size_t aLength = strlen(a);
+	size_t bLength = strlen(b);
+	if (aLength > bLength) {
+		return paths_overlap(b, a);
+	}
+	return strncmp(a, b, aLength) == 0 && (b[aLength] == '\0' || b[aLength] == '/');
+}
+
+// Running lines that must complete before slot can start, counted from head
+LINKAGE_PRIVATE size_t conflicts(LineSlot* slot) {
+	size_t count = 0;
+	for (size_t i = 0; i < running; i++) {
+		LineSlot* other = &slots[(head + i) % slotCount];
+		for (size_t j = 0; j < other->pathCount && count <= i; j++) {
+			for (size_t k = 0; k < slot->pathCount; k++) {
+				// Lines only reading a file (running the same command) share it
+				if ((other->written[j] || slot->written[k]) && paths_overlap(other->paths[j], slot->paths[k])) {
+					count = i + 1;
+					break;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+LINKAGE_PRIVATE void write_out(int captured, int fd) {
+	int err = relay_replay(captured, fd);
+	if (err) {
+		ERROR(err, "Unable to write out captured output");
+	}
+	close(captured);
+}
+
+// Waits for the oldest running line and writes out what it printed
+LINKAGE_PRIVATE void retire_head() {
+	LineSlot* slot = &slots[head];
+	Job* job = slot->jobId == 0 ? NULL : jobs_find(slot->jobId);
+	int status = 0;
+	if (job != NULL) {
+		job_wait(job);
+		status = job->status;
+		if (job->state == JOB_DONE) {
+			job_remove(job);
+		}
+	} else if (slot->jobId == 0) {
+		while (waitpid(slot->pid, &status, 0) == FAIL_COND && errno == EINTR);
+	}
+	// Lines retire in script order, so the last one retired is the last one run
+	execute_status_record(status);
+	// Anything the shell buffered itself was printed before this line started
+	fflush(stdout);
+	fflush(stderr);
+	write_out(slot->out, STDOUT_FILENO);
+	write_out(slot->err, STDERR_FILENO);
+	head = (head + 1) % slotCount;
+	running--;
+}
+
+// Writes out lines that have completed, up to the first still running
+LINKAGE_PRIVATE void retire_done() {
+	jobs_reap();
+	while (running > 0) {
+		Job* job = slots[head].jobId == 0 ? NULL : jobs_find(slots[head].jobId);
+		if (job != NULL && job->state == JOB_RUNNING) {
+			break;
+		}
+		retire_head();
+	}
+}
+
+LINKAGE_PUBLIC void concurrent_drain() {
+	while (running > 0) {
+		retire_head();
+	}
+}
+
+__attribute__((noreturn))
+LINKAGE_PRIVATE void line_main(CommandTable* table, int out, int err) {
+	// Commands it spawns must be its own children to be waited on
+	zygote_detach();
+	if (dup2(out, STDOUT_FILENO) == FAIL_COND || dup2(err, STDERR_FILENO) == FAIL_COND) {
+		_exit(1);
+	}
+	execute(table);
+	// Not fflush(NULL), that would rewind the shell's script stream shared with the parent
+	fflush(stdout);
+	fflush(stderr);
+	_exit(execute_status());
+}
+
+// 0: Started in slot, Otherwise: errno (nothing was started)
+LINKAGE_PRIVATE int line_start(LineSlot* slot, CommandTable* table) {
+	int err;
+	if ((slot->out = memfd_create("anubis-stdout", MFD_CLOEXEC)) == FAIL_COND) {
+		return errno;
+	} else if ((slot->err = memfd_create("anubis-stderr", MFD_CLOEXEC)) == FAIL_COND) {
+		err = errno;
+		close(slot->out);
+		return err;
+	}
+	// Otherwise the child would print the shell's buffered output a second time
+	fflush(stdout);
+	fflush(stderr);
+	if ((slot->pid = fork()) == 0) {
+		line_main(table, slot->out, slot->err);
+	} else if (slot->pid == FAIL_COND) {
+		err = errno;
+		close(slot->out);
+		close(slot->err);
+		return err;
+	}
+	Job* job = job_new(table->lines[0]);
+	if (job != NULL && job_add_process(job, slot->pid, 0) == 0) {
+		// Not one of the script's background jobs, whatever the line holds
+		job->background = false;
+		slot->jobId = job->id;
+	} else {
+		slot->jobId = 0;
+	}
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC bool concurrent_execute(CommandTable* table) {
+	if (slots == NULL || table->lineCount == 0) {
+		return false;
+	}
+	retire_done();
+	if (is_barrier(table)) {
+		concurrent_drain();
+		return false;
+	}
+	if (running == slotCount) {
+		retire_head();
+	}
+	// Retiring lines moves head and running together, the free slot stays put
+	LineSlot* slot = &slots[(head + running) % slotCount];
+	if (footprint_collect(slot, table)) {
+		concurrent_drain();
+		return false;
+	}
+	for (size_t count = conflicts(slot); count > 0; count--) {
+		retire_head();
+	}
+	if (line_start(slot, table)) {
+		concurrent_drain();
+		return false;
+	}
+	running++;
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef ANUBIS_CONCURRENT_H
+#define ANUBIS_CONCURRENT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "structure.h"
+
+/* Independent batch lines run concurrently (ANUBIS_PARALLEL_LINES). Each line's
+ * footprint is the files it may touch: its > target and every argument that is
+ * not an option, taken to be written, and the command when given as a path,
+ * only read. A line that shares no file (or directory holding one) written by
+ * either side with the lines still running is started in a forked copy of the
+ * shell, with its stdout and stderr captured in memory. Captured output is
+ * written out in script order as lines complete, so the result reads as if run
+ * one by one. Builtins and lines left in the background change the shell itself
+ * and are barriers: everything before them completes first, as are lines with
+ * process substitutions. Only the files
+ * named on a line are seen, a command reading or writing others (or the shell's
+ * stdin) must be kept apart with a barrier such as wait. Path lookups made by
+ * those copies are not remembered by the shell's hash table. Not used while
+ * accounting or tracing, which record what the shell itself runs.
+ */
+
+// 0: Lines up to slots at once, Otherwise: errno (nothing is run concurrently)
+int concurrent_init(size_t slots);
+void concurrent_free();
+bool concurrent_active();
+
+/* true: The line is running concurrently, false: The caller is to execute it,
+ * every line started before has completed and been written out
+ */
+bool concurrent_execute(CommandTable* table);
+// Waits for every running line, writing out their output in order
+void concurrent_drain();
+
+#endif // ANUBIS_CONCURRENT_H
@@ -1,6 +1,63 @@
+#define _GNU_SOURCE
+
 #include "error.h"
 
+static __thread ErrorSink* errorSink = NULL;
+
+ErrorSink* error_capture(ErrorSink* sink) {
+    ErrorSink* previous = errorSink;
+    errorSink = sink;
+    return previous;
+}
+
+void error_replay(const ErrorSink* errors) {
+    const char* message = errors->messages;
+    for (size_t i = 0; i < errors->count; i++) {
+        // Counted but not stored (out of memory), replayed without its text
+        if (message == NULL || message >= &errors->messages[errors->length]) {
+            ERROR(0, "Deferred error");
+            continue;
+        }
+        ERROR(0, "%s", message);
+        message += strlen(message) + 1;
+    }
+}
+
+// Appends the message to the sink, which is uninstalled meanwhile so a failure here is printed
+static void error_store(ErrorSink* sink, int errnum, const char* format, va_list args) {
+    if (sink->arena == NULL) {
+        return;
+    }
+    errorSink = NULL;
+    char* message = NULL;
+    int length = vasprintf(&message, format, args);
+    if (length >= 0 && errnum > 0) {
+        char* described = NULL;
+        length = asprintf(&described, "%s: %s", message, strerror(errnum));
+        free(message);
+        message = described;
+    }
+    char* grown;
+    if (length >= 0 && (grown = arena_realloc(sink->arena, sink->messages, sink->length, sink->length + length + 1)) != NULL) {
+        memcpy(&grown[sink->length], message, length + 1);
+        sink->messages = grown;
+        sink->length += length + 1;
+    }
+    if (length >= 0) {
+        free(message);
+    }
+    errorSink = sink;
+}
+
 void ERROR(int errnum, const char * format, ... ) {
+    if(errorSink != NULL) {
+        va_list args;
+        va_start (args, format);
+        error_store(errorSink, errnum, format, args);
+        va_end (args);
+        errorSink->count++;
+        return;
+    }
     if(_DEBUG) {
         va_list args;
         va_start (args, format);
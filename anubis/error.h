@@ -6,6 +6,8 @@
 #include <stdarg.h>
 #include <string.h>
 
+#include "arena.h"
+
 // Use this _DEBUG variable to control the error messages printed
 // by the ERROR function.
 //  _DEBUG=0: print only one error message; 
@@ -16,4 +18,19 @@
 
 void ERROR(int errnum, const char * format, ... );
 
+// Errors raised while a sink is installed (per thread) are kept instead of printed
+typedef struct ErrorSink {
+    // Holds the messages, NULL: only counted while capturing, or stored elsewhere (the script cache)
+    Arena* arena;
+    size_t count;
+    // count messages, as _DEBUG prints them, each NUL terminated and back to back
+    char* messages;
+    size_t length;
+} ErrorSink;
+
+// NULL restores printing, returns the previously installed sink
+ErrorSink* error_capture(ErrorSink* sink);
+// Print the deferred errors, as they would have been when raised
+void error_replay(const ErrorSink* errors);
+
 #endif // ANUBIS_ERROR_H
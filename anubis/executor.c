@@ -1,11 +1,15 @@
+#define _GNU_SOURCE
+
 #include "executor.h"
 
 #include <stddef.h>
 #include <stdio.h>
-#include <sys/fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 
 #include "checks.h"
@@ -13,87 +17,65 @@
 #include "mem_utils.h"
 #include "builtin.h"
 #include "math_utils.h"
-#include "self_pipe.h"
+#include "spawn.h"
+#include "jobs.h"
+#include "utility.h"
+#include "pipe_size.h"
+#include "account.h"
+#include "trace.h"
+#include "options.h"
+#include "zygote.h"
+#include "relay.h"
 #include "visibility.h"
 
 #define READ_PORT 0
 #define WRITE_PORT 1
 #define FAIL_COND -1
+#define NO_FD -1
+// Exit status is only known once the line's job has been waited on
+#define STATUS_FROM_JOB -1
+#define STATUS_FAILURE 1
+#define STATUS_NOT_EXECUTABLE 126
+#define STATUS_NOT_FOUND 127
+#define STATUS_SIGNAL_BASE 128
 
-typedef struct IO {
-	int in;
-	int out;
-} IO;
+static int lastStatus = 0;
 
 __attribute__((hot))
 LINKAGE_PRIVATE IO io_new() {
-	return (IO) { 0 };
-}
-
-__attribute__((hot))
-LINKAGE_PRIVATE IO stdio_save() {
 	return (IO) {
-		dup(STDIN_FILENO),
-		dup(STDOUT_FILENO)
+		STDIN_FILENO,
+		STDOUT_FILENO
 	};
 }
 
 __attribute__((hot))
-LINKAGE_PRIVATE int io_restore(IO* stdio) {
-	errno_return(dup2(stdio->in, STDIN_FILENO), FAIL_COND, "Unable to duplicate STDIN");
-	errno_return(dup2(stdio->out, STDOUT_FILENO), FAIL_COND, "Unable to duplicate STDOUT");
-	errno_return(close(stdio->in), FAIL_COND, "Unable to close STDIN");
-	errno_return(close(stdio->out), FAIL_COND, "Unable to close STDOUT");
-	return 0;
-}
-
-__attribute__((hot))
-LINKAGE_PRIVATE int redirect(int fd, int std) {
-	errno_return(dup2(fd, std), FAIL_COND, "Unable to redirect %d -> %d", fd, std);
-	errno_return(close(fd), FAIL_COND, "Unable to close %d", fd);
-	return 0;
-}
-
-__attribute__((hot, noreturn))
-LINKAGE_PRIVATE int exec_child(Command* command, int selfPipe[2]) {
-	if (close(selfPipe[READ_PORT])) {
-		ERROR(errno, "Unabe to close self pipe read port from child");
-		exit(errno);
-		__builtin_unreachable();
+LINKAGE_PRIVATE void io_close(IO* io) {
+	// Only the plan's own descriptors are released, the shell's stdio is never touched
+	if (io->in != STDIN_FILENO) {
+		close(io->in);
 	}
-	char* resolved = path_resolve(command->command);
-	if (resolved == NULL) {
-		self_pipe_send(selfPipe, ENOENT);
-		exit(0);
-		__builtin_unreachable();
+	if (io->out != STDOUT_FILENO) {
+		close(io->out);
 	}
-	checked_free(command->command);
-	command->command = resolved;
-	execv(command->command, command->args);
-	self_pipe_send(selfPipe, errno);
-	exit(0);
-	__builtin_unreachable();
 }
 
 __attribute__((hot))
-LINKAGE_PRIVATE int configure_input(char* infile, IO* stdio, IO* fileio) {
-	if (infile != NULL) {
-		if ((fileio->in = open(infile, O_RDONLY)) == FAIL_COND) {
-			return errno;
-		}
-	} else if ((fileio->in = dup(stdio->in)) == FAIL_COND) {
+LINKAGE_PRIVATE int configure_input(char* infile, IO* io) {
+	if (infile != NULL && (io->in = open(infile, O_RDONLY | O_CLOEXEC)) == FAIL_COND) {
 		return errno;
 	}
 	return 0;
 }
 
 __attribute__((hot))
-LINKAGE_PRIVATE int configure_output(bool isLast, IO* stdio, IO* fileio, char* outfile) {
+LINKAGE_PRIVATE int configure_output(bool isLast, IO* io, int* nextIn, char* outfile) {
+	*nextIn = NO_FD;
 	if (!isLast) {
 		// Not last command (piped)
-		// Create a pipe
+		// Create a pipe, close-on-exec so that only the descriptors installed in a child survive
 		int pipes[2];
-		errno_return(pipe(pipes), -1, "Unable to construct pipe to connect commands");
+		errno_return(pipe2(pipes, O_CLOEXEC), -1, "Unable to construct pipe to connect commands");
 		/* NOTE: In theory you could do zero-copy between processes to avoid buffered IPC that
 		 *       is the standard pipe(...) way. Something like this: first create 2 common files
 		 *       to use between processes and then mmap() them into memory progressizely. First
@@ -115,101 +97,689 @@ LINKAGE_PRIVATE int configure_output(bool isLast, IO* stdio, IO* fileio, char* o
 		 *       it would be filled with pages that are held by the kernel but not used by the reading
 		 *       proc yet, or yielded for GC. Definitely some issues to consider before a full
 		 *       implementation is possible.
+		 *       What the shell can do without any of that is avoid the copy through user space
+		 *       for data it moves itself, see relay.c (used by the in-process cat).
 		 */
-		fileio->out = pipes[WRITE_PORT];
-		fileio->in = pipes[READ_PORT];
+		pipe_size_apply(pipes[WRITE_PORT]);
+		io->out = pipes[WRITE_PORT];
+		*nextIn = pipes[READ_PORT];
 	} else if (outfile != NULL) {
-		if ((fileio->out = open(outfile, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR)) == FAIL_COND) {
+		if ((io->out = open(outfile, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)) == FAIL_COND) {
 			return errno;
 		}
-	} else if ((fileio->out = dup(stdio->out)) == FAIL_COND) {
-		return errno;	
+	} else {
+		io->out = STDOUT_FILENO;
+	}
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE int redirect_save(IO* io, IO* saved) {
+	*saved = io_new();
+	if (io->in != STDIN_FILENO) {
+		errno_return(saved->in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0), FAIL_COND, "Unable to save STDIN");
+		errno_return(dup2(io->in, STDIN_FILENO), FAIL_COND, "Unable to redirect %d -> STDIN", io->in);
+	}
+	if (io->out != STDOUT_FILENO) {
+		errno_return(saved->out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0), FAIL_COND, "Unable to save STDOUT");
+		errno_return(dup2(io->out, STDOUT_FILENO), FAIL_COND, "Unable to redirect %d -> STDOUT", io->out);
 	}
 	return 0;
 }
 
 __attribute__((hot))
-LINKAGE_PRIVATE int invoke_builtin_checked(Command* command) {
+LINKAGE_PRIVATE int redirect_restore(IO* saved) {
+	if (saved->in != STDIN_FILENO) {
+		errno_return(dup2(saved->in, STDIN_FILENO), FAIL_COND, "Unable to restore STDIN");
+	}
+	if (saved->out != STDOUT_FILENO) {
+		errno_return(dup2(saved->out, STDOUT_FILENO), FAIL_COND, "Unable to restore STDOUT");
+	}
+	io_close(saved);
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE int invoke_builtin_checked(Command* command, IO* io) {
+	if (builtin_lookup(command->command) == NULL) {
+		return FAIL_COND;
+	}
 	size_t argCount = DEC_FLOOR(DEC_FLOOR(command->argCount));
-	return builtin_execv(
+	// Builtins run in the shell itself, so the plan is installed around the call only
+	IO saved;
+	int ret;
+	transparent_return(redirect_save(io, &saved));
+	uint64_t start = TRACE_BEGIN();
+	int err = builtin_execv(
 		command->command,
 		argCount == 0 ? NULL : &command->args[1],
 		argCount
 	);
+	TRACE_END(TRACE_BUILTIN, start);
+	transparent_return(redirect_restore(&saved));
+	return err;
+}
+
+// Output of a background line being captured (ANUBIS_JOB_OUTPUT), see jobs.h
+typedef struct Capture {
+	// NO_FD: Written directly
+	int out;
+	int err;
+	// The shell's stderr while the line's is installed
+	int savedErr;
+} Capture;
+
+// Commands started until capture_end(...) write their stderr to the capture, stdout only as the last stage
+LINKAGE_PRIVATE void capture_begin(CommandLine* line, Capture* capture) {
+	*capture = (Capture) { NO_FD, NO_FD, NO_FD };
+	if (!line->bgOp || options.jobOutput != JOB_OUTPUT_CAPTURE) {
+		return;
+	}
+	// Without any of the three it is written directly, as it would otherwise be
+	if ((capture->out = memfd_create("anubis-job-stdout", MFD_CLOEXEC)) == FAIL_COND
+		|| (capture->err = memfd_create("anubis-job-stderr", MFD_CLOEXEC)) == FAIL_COND
+		|| (capture->savedErr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0)) == FAIL_COND
+		|| dup2(capture->err, STDERR_FILENO) == FAIL_COND) {
+		if (capture->savedErr != NO_FD) {
+			close(capture->savedErr);
+		}
+		if (capture->err != NO_FD) {
+			close(capture->err);
+		}
+		if (capture->out != NO_FD) {
+			close(capture->out);
+		}
+		*capture = (Capture) { NO_FD, NO_FD, NO_FD };
+	}
+}
+
+// The job takes the captured output, without one (e.g. only builtins ran) it is written out now
+LINKAGE_PRIVATE void capture_end(Capture* capture, Job* job) {
+	if (capture->out == NO_FD) {
+		return;
+	}
+	dup2(capture->savedErr, STDERR_FILENO);
+	close(capture->savedErr);
+	if (job != NULL) {
+		job->capturedOut = capture->out;
+		job->capturedErr = capture->err;
+		return;
+	}
+	relay_replay(capture->out, STDOUT_FILENO);
+	relay_replay(capture->err, STDERR_FILENO);
+	close(capture->out);
+	close(capture->err);
+}
+
+/* Pipeline ends of process substitutions not yet started. Close-on-exec keeps
+ * them from commands, tasks forked without an exec close them on entry.
+ */
+static int* pendingEnds = NULL;
+static size_t pendingCount = 0;
+
+LINKAGE_PRIVATE int pending_add(int fd) {
+	int* grown = realloc(pendingEnds, (pendingCount + 1) * sizeof(*pendingEnds));
+	if (grown == NULL) {
+		return ENOMEM;
+	}
+	pendingEnds = grown;
+	pendingEnds[pendingCount++] = fd;
+	return 0;
+}
+
+LINKAGE_PRIVATE void pending_remove(int fd) {
+	for (size_t i = 0; i < pendingCount; i++) {
+		if (pendingEnds[i] == fd) {
+			pendingEnds[i] = pendingEnds[--pendingCount];
+			return;
+		}
+	}
+}
+
+LINKAGE_PRIVATE void pending_close() {
+	for (size_t i = 0; i < pendingCount; i++) {
+		close(pendingEnds[i]);
+	}
+}
+
+typedef struct UtilityTask {
+	Utility* utility;
+	char** args;
+	size_t argCount;
+} UtilityTask;
+
+LINKAGE_PRIVATE int run_utility_task(void* context, IO* io) {
+	UtilityTask* task = context;
+	pending_close();
+	return task->utility->run(io->in, io->out, task->args, task->argCount);
+}
+
+// 0: Ran in-process (status is its exit status) or launched without an exec, Otherwise: errno of the failed fork
+__attribute__((hot))
+LINKAGE_PRIVATE int invoke_utility(Utility* utility, Command* command, bool inProcess, IO* io, int nextIn, pid_t* pid, int* status) {
+	size_t argCount = DEC_FLOOR(DEC_FLOOR(command->argCount));
+	UtilityTask task = { utility, &command->args[1], argCount };
+	if (inProcess) {
+		// The exit status is the utility's own concern, like any external command
+		uint64_t start = TRACE_BEGIN();
+		*status = utility->run(io->in, io->out, task.args, task.argCount);
+		TRACE_END(TRACE_UTILITY, start);
+		*pid = 0;
+		return 0;
+	}
+	uint64_t start = TRACE_BEGIN();
+	int ret = spawn_task(run_utility_task, &task, io, nextIn, pid);
+	TRACE_END(TRACE_SPAWN, start);
+	return ret;
+}
+
+LINKAGE_PRIVATE int run_builtin_task(void* context, IO* io) {
+	Command* command = context;
+	pending_close();
+	// The builtin's own commands are children of this task, not of the zygote
+	zygote_detach();
+	if ((io->in != STDIN_FILENO && dup2(io->in, STDIN_FILENO) == FAIL_COND)
+		|| (io->out != STDOUT_FILENO && dup2(io->out, STDOUT_FILENO) == FAIL_COND)) {
+		ERROR(errno, "Unable to redirect %s", command->command);
+		return STATUS_FAILURE;
+	}
+	size_t argCount = DEC_FLOOR(DEC_FLOOR(command->argCount));
+	int err = builtin_execv(command->command, argCount == 0 ? NULL : &command->args[1], argCount);
+	if (err > 0) {
+		ERROR(err, "%s", command->command);
+	}
+	return err == 0 ? 0 : STATUS_FAILURE;
 }
 
+// A builtin streaming the output of its own commands, forked so that a later stage reads it as it is written
+LINKAGE_PRIVATE int invoke_builtin_task(Command* command, IO* io, int nextIn, pid_t* pid) {
+	// Otherwise the task would write the shell's buffered output a second time
+	fflush(stdout);
+	fflush(stderr);
+	uint64_t start = TRACE_BEGIN();
+	int ret = spawn_task(run_builtin_task, command, io, nextIn, pid);
+	TRACE_END(TRACE_SPAWN, start);
+	return ret;
+}
+
+// 0: Launched (pid is 0 if nothing is left to wait on), Otherwise: errno, FAIL_COND is never returned
 __attribute__((hot))
-LINKAGE_PRIVATE int execute_command_line(CommandLine* line) {
+LINKAGE_PRIVATE int invoke_command(CommandLine* line, Command* command, bool inProcess, bool direct, IO* io, int nextIn, Job* job, pid_t* pid, int* status) {
+	*pid = 0;
+	BuiltIn* builtin = builtin_lookup(command->command);
+	bool task = builtin != NULL && builtin->task && !inProcess;
+	// Invoke builtins conditonally (allows for piped usage)
+	int err = task ? FAIL_COND : invoke_builtin_checked(command, io);
+	*status = err ? STATUS_FAILURE : 0;
+	if (err == BUILTIN_FAILED) {
+		return 0;
+	} else if (err != FAIL_COND) {
+		return err;
+	}
+	if (line->bgOp && job == NULL) {
+		// First process of a background pipeline, wait for a free slot
+		jobs_admit_background();
+	}
+	if (task) {
+		*status = STATUS_FROM_JOB;
+		return invoke_builtin_task(command, io, nextIn, pid);
+	}
+	// Resolve in the parent so the lookup cache persists across commands
+	uint64_t start = TRACE_BEGIN();
+	char* resolved = path_resolve(command->command);
+	TRACE_END(TRACE_RESOLVE, start);
+	// Utilities only stand in for what the path would run
+	Utility* utility = utility_lookup(command->command, resolved, &command->args[1], DEC_FLOOR(DEC_FLOOR(command->argCount)));
+	if (utility != NULL) {
+		free(resolved);
+		*status = STATUS_FROM_JOB;
+		return invoke_utility(utility, command, inProcess, io, nextIn, pid, status);
+	}
+	start = TRACE_BEGIN();
+	err = resolved == NULL ? ENOENT
+		: direct ? spawn_direct(resolved, command->args, io, pid)
+		: spawn_command(resolved, command->args, io, pid);
+	TRACE_END(TRACE_SPAWN, start);
+	checked_free(resolved);
+	*status = err == 0 ? STATUS_FROM_JOB : err == ENOENT ? STATUS_NOT_FOUND : STATUS_NOT_EXECUTABLE;
+	return err;
+}
+
+// Builtin and in-process only lines never get a job, it is made for the first process
+LINKAGE_PRIVATE Job* job_track(CommandLine* line, Job* job, int* jobId, pid_t pid, size_t stage) {
+	if (job == NULL && (job = job_new(line)) != NULL) {
+		*jobId = job->id;
+	}
+	if (job != NULL) {
+		job_add_process(job, pid, stage);
+	}
+	return job;
+}
+
+#define FD_PATH_FORMAT "/dev/fd/%d"
+#define FD_PATH_SIZE 24
+
+// Pipes of a command's process substitutions while it is launched
+typedef struct Substituted {
+	size_t count;
+	// Per substitution, the end named by the path given to the command and the end of its pipeline
+	int* outer;
+	int* inner;
+	char (*paths)[FD_PATH_SIZE];
+	// The command with the paths in place of its <( and >( arguments
+	Command command;
+} Substituted;
+
+LINKAGE_PRIVATE void substituted_free(Substituted* substituted) {
+	free(substituted->outer);
+	free(substituted->inner);
+	free(substituted->paths);
+	free(substituted->command.args);
+}
+
+// 0: A pipe for each of the command's substitutions (if any), Otherwise: errno (nothing is left open)
+LINKAGE_PRIVATE int substituted_open(Command* command, Substituted* substituted) {
+	*substituted = (Substituted) { .command = *command };
+	if (command->substitutionCount == 0) {
+		return 0;
+	}
+	size_t count = command->substitutionCount;
+	substituted->outer = calloc(count, sizeof(*substituted->outer));
+	substituted->inner = calloc(count, sizeof(*substituted->inner));
+	substituted->paths = calloc(count, sizeof(*substituted->paths));
+	substituted->command.args = malloc(command->argCount * sizeof(*command->args));
+	if (substituted->outer == NULL || substituted->inner == NULL || substituted->paths == NULL || substituted->command.args == NULL) {
+		substituted_free(substituted);
+		return ENOMEM;
+	}
+	memcpy(substituted->command.args, command->args, command->argCount * sizeof(*command->args));
+	for (; substituted->count < count; substituted->count++) {
+		Substitution* substitution = &command->substitutions[substituted->count];
+		int pipes[2];
+		int err = pipe2(pipes, O_CLOEXEC) == FAIL_COND ? errno : 0;
+		if (err == 0 && (err = pending_add(pipes[substitution->output ? READ_PORT : WRITE_PORT]))) {
+			close(pipes[READ_PORT]);
+			close(pipes[WRITE_PORT]);
+		}
+		if (err) {
+			for (size_t i = 0; i < substituted->count; i++) {
+				pending_remove(substituted->inner[i]);
+				close(substituted->outer[i]);
+				close(substituted->inner[i]);
+			}
+			substituted_free(substituted);
+			return err;
+		}
+		pipe_size_apply(pipes[WRITE_PORT]);
+		substituted->outer[substituted->count] = pipes[substitution->output ? WRITE_PORT : READ_PORT];
+		substituted->inner[substituted->count] = pipes[substitution->output ? READ_PORT : WRITE_PORT];
+		char* path = substituted->paths[substituted->count];
+		snprintf(path, FD_PATH_SIZE, FD_PATH_FORMAT, substituted->outer[substituted->count]);
+		substituted->command.args[substitution->argIndex] = path;
+	}
+	return 0;
+}
+
+// Lets the command inherit the ends named by its paths, only while it is launched
+LINKAGE_PRIVATE void substituted_inherit(Substituted* substituted, bool inherit) {
+	for (size_t i = 0; i < substituted->count; i++) {
+		fcntl(substituted->outer[i], F_SETFD, inherit ? 0 : FD_CLOEXEC);
+	}
+}
+
+LINKAGE_PRIVATE int launch_command(CommandLine* line, Command* command, bool inProcess, IO* io, int nextIn, Job** job, int* jobId, pid_t* pid, int* status);
+
+// Starts a substitution's pipeline on end, closed here, from the shell's stdin or to its stdout at the other end
+LINKAGE_PRIVATE void substitution_start(CommandLine* line, Substitution* substitution, int end, Job** job, int* jobId) {
+	IO io = io_new();
+	io.in = substitution->output ? end : STDIN_FILENO;
+	bool pending = !substitution->output;
+	for (size_t i = 0; i < substitution->pipeCount; i++) {
+		bool isLast = i == substitution->pipeCount - 1;
+		int nextIn = NO_FD;
+		if (isLast) {
+			io.out = substitution->output ? STDOUT_FILENO : end;
+			pending = false;
+		} else if (configure_output(false, &io, &nextIn, NULL)) {
+			io_close(&io);
+			break;
+		}
+		Command* command = substitution->pipes[i];
+		pid_t pid;
+		int status;
+		int err = launch_command(line, command, false, &io, nextIn, job, jobId, &pid, &status);
+		if (err == 0 && pid != 0) {
+			*job = job_track(line, *job, jobId, pid, STAGE_SUBSTITUTION);
+		}
+		io_close(&io);
+		if (err) {
+			ERROR(err, "%s", command->command);
+			if (nextIn != NO_FD) {
+				close(nextIn);
+			}
+			break;
+		}
+		io.in = nextIn;
+	}
+	if (pending) {
+		close(end);
+	}
+}
+
+/* Substitutions are given the ends of their pipelines only once the command has
+ * been launched and the shell holds none of its ends, so that no process
+ * started for them holds one either (the command sees EOF and EPIPE as it would
+ * from a file), nor does the command hold the other ends. The processes are
+ * tracked in the line's job ahead of the command.
+ */
+__attribute__((hot))
+LINKAGE_PRIVATE int launch_command(CommandLine* line, Command* command, bool inProcess, IO* io, int nextIn, Job** job, int* jobId, pid_t* pid, int* status) {
+	Substituted substituted;
+	int err = substituted_open(command, &substituted);
+	if (err) {
+		*pid = 0;
+		*status = STATUS_FAILURE;
+		return err;
+	}
+	if (substituted.count == 0) {
+		return invoke_command(line, command, inProcess, false, io, nextIn, *job, pid, status);
+	}
+	substituted_inherit(&substituted, true);
+	// The command is never run in-process, it reads or writes the substitutions while they run
+	err = invoke_command(line, &substituted.command, false, true, io, nextIn, *job, pid, status);
+	substituted_inherit(&substituted, false);
+	for (size_t i = 0; i < substituted.count; i++) {
+		close(substituted.outer[i]);
+	}
+	for (size_t i = 0; i < substituted.count; i++) {
+		// Its own pipeline holds it from here, the tasks forked for it included
+		pending_remove(substituted.inner[i]);
+		if (err) {
+			close(substituted.inner[i]);
+		} else {
+			substitution_start(line, &command->substitutions[i], substituted.inner[i], job, jobId);
+		}
+	}
+	substituted_free(&substituted);
+	return err;
+}
+
+typedef struct FanOutTask {
+	int* outs;
+	size_t count;
+} FanOutTask;
+
+LINKAGE_PRIVATE int run_fan_out_task(void* context, IO* io) {
+	FanOutTask* task = context;
+	pending_close();
+	// A branch that stops reading is dropped rather than ending the relay
+	signal(SIGPIPE, SIG_IGN);
+	int err = relay_fan_out(io->in, task->outs, task->count);
+	if (err) {
+		ERROR(err, "Unable to fan out");
+	}
+	return err ? STATUS_FAILURE : 0;
+}
+
+/* Starts each branch on a pipe of its own and then the relay feeding them from
+ * in, the read end of the pipeline's output, which is closed here. Every branch
+ * is started before the next pipe exists and its read end is closed straight
+ * away, so that only the branch holds it and the relay sees EPIPE once it exits.
+ */
+LINKAGE_PRIVATE int execute_fan_out(CommandLine* line, int in, Capture* capture, Job** job, int* jobId, int* status) {
+	size_t count = line->branchCount;
+	int* outs = calloc(count, sizeof(*outs));
+	pid_t* pids = calloc(count, sizeof(*pids));
+	IO shared = io_new();
+	size_t started = 0;
+	int err = outs == NULL || pids == NULL ? ENOMEM : configure_output(true, &shared, &(int) { NO_FD }, line->ioModifiers->outTrunc);
+	if (err) {
+		ERROR(err, "Unable to configure output");
+		*status = STATUS_FAILURE;
+	} else if (line->ioModifiers->outTrunc != NULL) {
+		// Branches write the file at once, splice and sendfile move its shared offset unlocked
+		fcntl(shared.out, F_SETFL, fcntl(shared.out, F_GETFL) | O_APPEND);
+	} else if (capture->out != NO_FD) {
+		int out = fcntl(capture->out, F_DUPFD_CLOEXEC, 0);
+		shared.out = out == FAIL_COND ? shared.out : out;
+	}
+	for (; err == 0 && started < count; started++) {
+		int pipes[2];
+		if (pipe2(pipes, O_CLOEXEC) == FAIL_COND) {
+			err = errno;
+			ERROR(err, "Unable to construct pipe to fan out");
+			*status = STATUS_FAILURE;
+			break;
+		}
+		pipe_size_apply(pipes[WRITE_PORT]);
+		outs[started] = pipes[WRITE_PORT];
+		Command* command = line->branches[started];
+		IO io = { pipes[READ_PORT], shared.out };
+		// Never in-process, the shell is needed to start the rest
+		err = launch_command(line, command, false, &io, pipes[WRITE_PORT], job, jobId, &pids[started], status);
+		close(pipes[READ_PORT]);
+		if (err) {
+			ERROR(err, "%s", command->command);
+			if (*status == STATUS_FROM_JOB) {
+				*status = STATUS_FAILURE;
+			}
+			started++;
+			break;
+		}
+	}
+	// The branches hold their own copies now
+	io_close(&shared);
+	pid_t relay = 0;
+	if (err == 0) {
+		FanOutTask task = { outs, count };
+		IO io = { in, STDOUT_FILENO };
+		uint64_t start = TRACE_BEGIN();
+		err = spawn_task(run_fan_out_task, &task, &io, FAIL_COND, &relay);
+		TRACE_END(TRACE_SPAWN, start);
+		if (err) {
+			ERROR(err, "Unable to start the fan-out relay");
+			*status = STATUS_FAILURE;
+		}
+	}
+	close(in);
+	for (size_t i = 0; outs != NULL && i < started; i++) {
+		close(outs[i]);
+	}
+	// Tracked after the relay, the line's status is that of its last branch
+	if (relay != 0) {
+		*job = job_track(line, *job, jobId, relay, line->pipeCount + count);
+	}
+	for (size_t i = 0; i < started; i++) {
+		if (pids[i] != 0) {
+			*job = job_track(line, *job, jobId, pids[i], line->pipeCount + i);
+		}
+	}
+	free(outs);
+	free(pids);
+	return err;
+}
+
+__attribute__((hot))
+// status: exit status of the last command, or STATUS_FROM_JOB if it is a process
+LINKAGE_PRIVATE int execute_command_line(CommandLine* line, int* jobId, int* status) {
 	INSTANCE_NULL_CHECK_RETURN("CommandLine", line, 1);
 	// Command structure
 	char* infile = NULL; // NOTE: Always null, we only support outfiles currently
-	char* outfile = checked_invocation(strdup, line->ioModifiers->outTrunc);
-	// Save stdin/stdout
-	IO stdio = stdio_save();
-	IO fileio = io_new();
+	char* outfile = line->ioModifiers->outTrunc;
+	IO io = io_new();
+	Job* job = NULL;
 	// Setup input
 	int ret;
-	transparent_return(configure_input(infile, &stdio, &fileio));
+	transparent_return(configure_input(infile, &io));
+	Capture capture;
+	capture_begin(line, &capture);
 	int err = 0;
 	for (int i = 0; i < line->pipeCount; i++) {
-		// Redirect input
-		transparent_return(redirect(fileio.in, STDIN_FILENO));
-		// Setup output
-		transparent_return(configure_output(
-			i == line->pipeCount - 1,
-			&stdio, &fileio,
-			outfile
-		));
-		// Redirect output
-		transparent_return(redirect(fileio.out, STDOUT_FILENO));
-		// Invoke builtins conditonally (allows for piped usage)
-		Command* command = line->pipes[i];
-		err = invoke_builtin_checked(command);
-		if (err == 0) {
-			continue;
-		} else if (err != FAIL_COND) {
-			ERROR(err, "%s", command->command);
+		// A fan-out's branches come last, the pipeline's output is theirs
+		bool isLast = i == line->pipeCount - 1 && line->branchCount == 0;
+		// Setup output, the read end of a new pipe becomes the next command's input
+		int nextIn;
+		if ((err = configure_output(isLast, &io, &nextIn, outfile))) {
+			ERROR(err, "Unable to configure output");
+			*status = STATUS_FAILURE;
+			io_close(&io);
 			break;
 		}
-		int selfPipe[2];
-		ret_return(self_pipe_new(selfPipe), != 0, "Unable to create selfPipe");
-		if ((ret = fork()) == 0) {
-			// Create child process
-			exec_child(command, selfPipe);
-		} else if (ret == FAIL_COND) {
-			err = errno;
-			ERROR(err, "Failed child fork");
-			break;
+		if (isLast && outfile == NULL && capture.out != NO_FD) {
+			// A descriptor of its own, closed with the rest of the plan
+			int out = fcntl(capture.out, F_DUPFD_CLOEXEC, 0);
+			io.out = out == FAIL_COND ? io.out : out;
+		}
+		Command* command = line->pipes[i];
+		pid_t pid;
+		// The last stage of a foreground line needs no process at all
+		err = launch_command(line, command, isLast && !line->bgOp, &io, nextIn, &job, jobId, &pid, status);
+		if (err == 0 && pid != 0) {
+			job = job_track(line, job, jobId, pid, i);
 		}
-		// Await error byte or close-on-exec
-		if (self_pipe_poll(selfPipe, &err)) {
+		// The children hold their own copies now
+		io_close(&io);
+		if (err != 0) {
 			ERROR(err, "%s", command->command);
-			if (close(selfPipe[READ_PORT])) {
-				ERROR(errno, "Unable to close self pipe read port");
-				// Allow fall through on double failure to capture original error not secondary close failure
+			if (*status == STATUS_FROM_JOB) {
+				*status = STATUS_FAILURE;
+			}
+			if (nextIn != NO_FD) {
+				close(nextIn);
 			}
 			break;
 		}
-		// Free resources
-		ret_return(self_pipe_free(selfPipe), != 0, "Unable to free selfPipe");
-		// Reset error for default success
-		err = 0;
+		io.in = nextIn;
 	}
-	// Restore in/out defaults
-	transparent_return(io_restore(&stdio));
-	if (!line->bgOp) {
-		// Wait for commands if last command in foreground
-		while (wait(NULL) >= 0);
+	if (err == 0 && line->branchCount > 0) {
+		err = execute_fan_out(line, io.in, &capture, &job, jobId, status);
 	}
+	capture_end(&capture, job);
 	return err;
 }
 
+// Per line state of a table being executed
+typedef struct LineRun {
+	// 0: No processes were started
+	int jobId;
+	int status;
+	Account account;
+} LineRun;
+
+LINKAGE_PRIVATE int status_from_wait(int status) {
+	return WIFSIGNALED(status) ? STATUS_SIGNAL_BASE + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// Waits for the jobs started by lines [from, to) and reports their usage
+__attribute__((hot))
+LINKAGE_PRIVATE void await_lines(CommandTable* table, LineRun* runs, size_t from, size_t to) {
+	for (size_t i = from; i < to; i++) {
+		// Missing if already waited on by a builtin
+		Job* job = runs[i].jobId == 0 ? NULL : jobs_find(runs[i].jobId);
+		if (job != NULL) {
+			job_wait(job);
+		}
+		if (runs[i].status == STATUS_FROM_JOB) {
+			// A job already waited on by a builtin has no status left to report
+			runs[i].status = job == NULL ? 0 : status_from_wait(job->status);
+		}
+		account_end(&runs[i].account, table->lines[i], job);
+		if (job != NULL && job->state == JOB_DONE) {
+			job_remove(job);
+		}
+	}
+}
+
 __attribute__((hot))
 LINKAGE_PUBLIC int execute(CommandTable* table) {
 	INSTANCE_NULL_CHECK_RETURN("CommandTable", table, 0);
-	int ret;
+	jobs_reap();
+	// Between lines, where whole captured output cannot split anything else
+	jobs_write_output();
+	jobs_prune();
+	// Jobs are tracked by id, builtins such as wait may remove them mid table
+	LineRun* runs = calloc(table->lineCount, sizeof(*runs));
+	INSTANCE_NULL_CHECK_RETURN("line runs", runs, ENOMEM);
+	int ret = 0;
+	size_t awaited = 0;
 	for (int i = 0; i < table->lineCount; i++) {
-		transparent_return(execute_command_line(table->lines[i]));
+		CommandLine* line = table->lines[i];
+		account_begin(&runs[i].account, line);
+		ret = execute_command_line(line, &runs[i].jobId, &runs[i].status);
+		if (!line->bgOp) {
+			// Parallel commands on an input line complete together, unless the line ends in &
+			await_lines(table, runs, awaited, i + 1);
+			awaited = i + 1;
+		}
+		// Like sh, a line left running in the background succeeds
+		lastStatus = line->bgOp && ret == 0 ? 0 : runs[i].status;
+		if (ret) {
+			break;
+		}
 	}
-	return 0;
+	free(runs);
+	jobs_write_output();
+	return ret;
+}
+
+LINKAGE_PUBLIC int execute_status() {
+	return lastStatus;
+}
+
+LINKAGE_PUBLIC void execute_status_record(int status) {
+	lastStatus = status_from_wait(status);
+}
+
+LINKAGE_PUBLIC void execute_status_set(int status) {
+	lastStatus = status;
+}
+
+// true: A lone external command, that nothing else needs the shell to outlive
+LINKAGE_PRIVATE bool replaceable(CommandTable* table) {
+	if (table->lineCount != 1 || trace_enabled || options.accounting != NULL || jobs_running_background() > 0) {
+		return false;
+	}
+	CommandLine* line = table->lines[0];
+	if (line->bgOp || line->timed || line->pipeCount != 1 || line->branchCount > 0 || line->pipes[0]->substitutionCount > 0) {
+		return false;
+	}
+	Command* command = line->pipes[0];
+	if (builtin_lookup(command->command) != NULL) {
+		return false;
+	}
+	char* resolved = path_resolve(command->command);
+	bool external = utility_lookup(command->command, resolved, &command->args[1], DEC_FLOOR(DEC_FLOOR(command->argCount))) == NULL;
+	checked_free(resolved);
+	return external;
+}
+
+// Only returns if the command could not replace the shell
+LINKAGE_PRIVATE void replace_shell(CommandLine* line) {
+	Command* command = line->pipes[0];
+	char* resolved = path_resolve(command->command);
+	IO io = io_new();
+	IO saved;
+	if (resolved == NULL || configure_output(true, &io, &(int) { NO_FD }, line->ioModifiers->outTrunc)) {
+		checked_free(resolved);
+		return;
+	}
+	if (redirect_save(&io, &saved) == 0) {
+		zygote_stop();
+		spawn_replace(resolved, command->args);
+		// Left for execute(...) to run and report as usual
+		redirect_restore(&saved);
+	}
+	io_close(&io);
+	free(resolved);
+}
+
+LINKAGE_PUBLIC int execute_final(CommandTable* table) {
+	INSTANCE_NULL_CHECK_RETURN("CommandTable", table, 0);
+	jobs_reap();
+	// No exit handler runs after the exec to write it out
+	jobs_write_output();
+	if (replaceable(table)) {
+		replace_shell(table->lines[0]);
+	}
+	return execute(table);
 }
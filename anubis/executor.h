@@ -4,5 +4,15 @@
 #include "structure.h"
 
 int execute(CommandTable* table);
+/* The last table of a script: a lone external command with nothing left to
+ * wait on replaces the shell rather than being forked and waited on
+ */
+int execute_final(CommandTable* table);
+// Exit status of the last line executed, as sh reports it in $?
+int execute_status();
+// Records the wait status of a line executed by a copy of the shell (see concurrent.h) as the last one
+void execute_status_record(int status);
+// Records the exit status of a line that did not execute (failed to parse) as the last one
+void execute_status_set(int status);
 
 #endif // ANUBIS_EXECUTOR_H
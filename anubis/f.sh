@@ -0,0 +1,2 @@
+echo x > o.txt
+sh -c "echo \$\$" > o.txt
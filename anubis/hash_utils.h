@@ -0,0 +1,19 @@
+#ifndef ANUBIS_HASHUTILS_H
+#define ANUBIS_HASHUTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64 bit FNV-1a, chain calls by passing the previous hash (start from FNV_OFFSET_BASIS)
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static inline uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+	for (const unsigned char* c = data; len > 0; c++, len--) {
+		hash ^= *c;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+#endif // ANUBIS_HASHUTILS_H
@@ -0,0 +1,356 @@
+#include "jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "checks.h"
+#include "mem_utils.h"
+#include "options.h"
+#include "relay.h"
+#include "trace.h"
+#include "visibility.h"
+
+#define INITIAL_PROCESS_CAPACITY 4
+#define INITIAL_JOB_CAPACITY 8
+
+const char* job_state_names[] = {
+	[JOB_RUNNING] = "Running",
+	[JOB_STOPPED] = "Stopped",
+	[JOB_DONE] = "Done"
+};
+
+// Ordered by id, ids are allocated one past the highest live id
+static Job** jobs = NULL;
+static size_t jobCount = 0;
+static size_t jobCapacity = 0;
+
+LINKAGE_PUBLIC Job* job_new_described(char* description, bool background) {
+	if (jobCount >= jobCapacity) {
+		size_t capacity = jobCapacity == 0 ? INITIAL_JOB_CAPACITY : jobCapacity * 2;
+		Job** resized = realloc(jobs, capacity * sizeof(*jobs));
+		INSTANCE_NULL_CHECK_RETURN("job table", resized, NULL);
+		jobs = resized;
+		jobCapacity = capacity;
+	}
+	Job* job = calloc(1, sizeof(*job));
+	INSTANCE_NULL_CHECK_RETURN("job", job, NULL);
+	job->id = jobCount == 0 ? 1 : jobs[jobCount - 1]->id + 1;
+	job->state = JOB_RUNNING;
+	job->background = background;
+	job->description = description;
+	job->capturedOut = -1;
+	job->capturedErr = -1;
+	clock_gettime(CLOCK_MONOTONIC, &job->started);
+	jobs[jobCount++] = job;
+	return job;
+}
+
+LINKAGE_PUBLIC Job* job_new(CommandLine* line) {
+	char* description = command_line_describe(line);
+	Job* job = job_new_described(description, line->bgOp);
+	if (job == NULL) {
+		checked_free(description);
+	}
+	return job;
+}
+
+LINKAGE_PUBLIC int job_add_process(Job* job, pid_t pid, size_t stage) {
+	INSTANCE_NULL_CHECK_RETURN("job", job, EINVAL);
+	if (job->processCount >= job->processCapacity) {
+		size_t capacity = job->processCapacity == 0 ? INITIAL_PROCESS_CAPACITY : job->processCapacity * 2;
+		JobProcess* resized = realloc(job->processes, capacity * sizeof(*job->processes));
+		INSTANCE_NULL_CHECK_RETURN("job processes", resized, ENOMEM);
+		job->processes = resized;
+		job->processCapacity = capacity;
+	}
+	job->processes[job->processCount++] = (JobProcess) {
+		.pid = pid,
+		.stage = stage
+	};
+	job->remaining++;
+	return 0;
+}
+
+LINKAGE_PUBLIC JobUsage job_usage_from(const struct rusage* usage) {
+	return (JobUsage) {
+		.user = usage->ru_utime,
+		.system = usage->ru_stime,
+		.maxRss = usage->ru_maxrss,
+		.voluntarySwitches = usage->ru_nvcsw,
+		.involuntarySwitches = usage->ru_nivcsw
+	};
+}
+
+LINKAGE_PUBLIC void job_usage_add(JobUsage* total, const JobUsage* usage) {
+	timeradd(&total->user, &usage->user, &total->user);
+	timeradd(&total->system, &usage->system, &total->system);
+	total->maxRss = usage->maxRss > total->maxRss ? usage->maxRss : total->maxRss;
+	total->voluntarySwitches += usage->voluntarySwitches;
+	total->involuntarySwitches += usage->involuntarySwitches;
+}
+
+// fd: The shell's own stdout or stderr, replaced by a file under options.jobOutputDir if set
+LINKAGE_PRIVATE void write_captured(Job* job, int captured, int fd, const char* extension) {
+	if (captured == -1) {
+		return;
+	}
+	char path[PATH_MAX];
+	int err = 0;
+	if (options.jobOutputDir != NULL) {
+		snprintf(path, sizeof(path), "%s/%d.%s", options.jobOutputDir, job->id, extension);
+		fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+		err = fd == -1 ? errno : 0;
+	}
+	if (err == 0) {
+		err = relay_replay(captured, fd);
+	}
+	if (err) {
+		ERROR(err, "Unable to write out the output of job %d", job->id);
+	}
+	if (options.jobOutputDir != NULL && fd != -1) {
+		close(fd);
+	}
+	close(captured);
+}
+
+LINKAGE_PUBLIC void job_write_output(Job* job) {
+	write_captured(job, job->capturedOut, STDOUT_FILENO, "out");
+	write_captured(job, job->capturedErr, STDERR_FILENO, "err");
+	job->capturedOut = -1;
+	job->capturedErr = -1;
+}
+
+LINKAGE_PRIVATE void job_free(Job* job) {
+	// Nothing captured is lost, even for a job removed before it was written out
+	job_write_output(job);
+	checked_free(job->processes);
+	checked_free(job->description);
+	free(job);
+}
+
+LINKAGE_PUBLIC void job_remove(Job* job) {
+	for (size_t i = 0; i < jobCount; i++) {
+		if (jobs[i] == job) {
+			memmove(&jobs[i], &jobs[i + 1], (jobCount - i - 1) * sizeof(*jobs));
+			jobCount--;
+			break;
+		}
+	}
+	job_free(job);
+}
+
+LINKAGE_PUBLIC Job* jobs_find(int id) {
+	for (size_t i = 0; i < jobCount; i++) {
+		if (jobs[i]->id == id) {
+			return jobs[i];
+		}
+	}
+	return NULL;
+}
+
+LINKAGE_PUBLIC Job* jobs_current() {
+	for (size_t i = jobCount; i > 0; i--) {
+		if (jobs[i - 1]->state != JOB_DONE) {
+			return jobs[i - 1];
+		}
+	}
+	return NULL;
+}
+
+LINKAGE_PRIVATE void record_status(pid_t pid, int status, const struct rusage* usage) {
+	for (size_t i = 0; i < jobCount; i++) {
+		Job* job = jobs[i];
+		if (job->state == JOB_DONE) {
+			continue;
+		}
+		for (size_t j = 0; j < job->processCount; j++) {
+			JobProcess* process = &job->processes[j];
+			if (process->pid != pid || process->exited) {
+				continue;
+			} else if (WIFSTOPPED(status)) {
+				job->state = JOB_STOPPED;
+				return;
+			}
+			process->exited = true;
+			process->status = status;
+			process->usage = job_usage_from(usage);
+			job_usage_add(&job->usage, &process->usage);
+			if (j == job->processCount - 1) {
+				job->status = status;
+			}
+			if (--job->remaining == 0) {
+				job->state = JOB_DONE;
+				clock_gettime(CLOCK_MONOTONIC, &job->finished);
+			}
+			return;
+		}
+	}
+	// Not tracked (e.g. a command whose exec failed), nothing to update
+}
+
+// 1: Reaped a child, 0: Nothing to reap without blocking, -1: No children remain
+__attribute__((hot))
+LINKAGE_PRIVATE int reap(int flags) {
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	// wait4 rather than waitpid, to account the resources of each command
+	while ((pid = wait4(-1, &status, flags | WUNTRACED, &usage)) == -1 && errno == EINTR);
+	if (pid == -1) {
+		return -1;
+	} else if (pid == 0) {
+		return 0;
+	}
+	record_status(pid, status, &usage);
+	return 1;
+}
+
+LINKAGE_PRIVATE void job_abandon(Job* job) {
+	// Children were reaped elsewhere, nothing left to wait for
+	job->remaining = 0;
+	job->state = JOB_DONE;
+	clock_gettime(CLOCK_MONOTONIC, &job->finished);
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int job_wait(Job* job) {
+	INSTANCE_NULL_CHECK_RETURN("job", job, EINVAL);
+	if (job->remaining == 0) {
+		job->state = JOB_DONE;
+	}
+	uint64_t start = TRACE_BEGIN();
+	while (job->state == JOB_RUNNING) {
+		if (reap(0) == -1) {
+			job_abandon(job);
+		}
+	}
+	TRACE_END(TRACE_WAIT, start);
+	return 0;
+}
+
+LINKAGE_PUBLIC int job_continue(Job* job, bool background) {
+	INSTANCE_NULL_CHECK_RETURN("job", job, EINVAL);
+	if (job->state == JOB_DONE) {
+		return 0;
+	}
+	for (size_t i = 0; i < job->processCount; i++) {
+		if (!job->processes[i].exited && kill(job->processes[i].pid, SIGCONT) == -1 && errno != ESRCH) {
+			return errno;
+		}
+	}
+	job->state = JOB_RUNNING;
+	job->background = background;
+	return 0;
+}
+
+LINKAGE_PUBLIC size_t jobs_running_background() {
+	size_t running = 0;
+	for (size_t i = 0; i < jobCount; i++) {
+		running += jobs[i]->background && jobs[i]->state == JOB_RUNNING;
+	}
+	return running;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC void jobs_admit_background() {
+	jobs_reap();
+	/* Hold the launch until a slot frees rather than queueing the line, the
+	 * unread remainder of the input is the queue. Started the moment any
+	 * running job exits, without parsed lines outliving their arena.
+	 */
+	while (jobs_running_background() >= options.jobLimit) {
+		if (reap(0) == -1) {
+			break;
+		}
+	}
+}
+
+LINKAGE_PUBLIC void jobs_reap() {
+	while (reap(WNOHANG) == 1);
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int jobs_reap_next() {
+	return reap(0);
+}
+
+LINKAGE_PRIVATE bool jobs_any_running() {
+	for (size_t i = 0; i < jobCount; i++) {
+		if (jobs[i]->state == JOB_RUNNING) {
+			return true;
+		}
+	}
+	return false;
+}
+
+LINKAGE_PUBLIC int jobs_wait_all() {
+	// Waits on the jobs rather than for no children to remain, the zygote is a child that never exits
+	while (jobs_any_running() && reap(0) != -1);
+	// Also collects children no job tracks, so nothing is left as a zombie
+	jobs_reap();
+	// A stopped job still has its processes, it is kept for fg or bg rather than waited on
+	for (size_t i = 0; i < jobCount; i++) {
+		if (jobs[i]->state == JOB_RUNNING) {
+			job_abandon(jobs[i]);
+		}
+	}
+	jobs_write_output();
+	return 0;
+}
+
+LINKAGE_PUBLIC void jobs_report() {
+	jobs_reap();
+	for (size_t i = 0; i < jobCount; i++) {
+		Job* job = jobs[i];
+		fprintf(stdout, "[%d] %s\t%s\n", job->id, job_state_names[job->state], job->description);
+	}
+	// Output is redirected per command, flush before the descriptors are restored
+	fflush(stdout);
+	for (size_t i = jobCount; i > 0; i--) {
+		if (jobs[i - 1]->state == JOB_DONE) {
+			job_remove(jobs[i - 1]);
+		}
+	}
+}
+
+LINKAGE_PUBLIC void jobs_prune() {
+	size_t done = 0;
+	for (size_t i = 0; i < jobCount; i++) {
+		done += jobs[i]->state == JOB_DONE;
+	}
+	for (size_t i = 0; i < jobCount && done > JOBS_DONE_RETENTION;) {
+		if (jobs[i]->state == JOB_DONE) {
+			job_remove(jobs[i]);
+			done--;
+			continue;
+		}
+		i++;
+	}
+}
+
+LINKAGE_PUBLIC void jobs_write_output() {
+	for (size_t i = 0; i < jobCount; i++) {
+		if (jobs[i]->state == JOB_DONE) {
+			job_write_output(jobs[i]);
+		}
+	}
+}
+
+LINKAGE_PUBLIC void jobs_free() {
+	for (size_t i = 0; i < jobCount; i++) {
+		job_free(jobs[i]);
+	}
+	checked_free(jobs);
+	jobs = NULL;
+	jobCount = 0;
+	jobCapacity = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef ANUBIS_JOBS_H
+#define ANUBIS_JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "structure.h"
+
+// Finished jobs kept around for jobs/wait before the oldest are discarded
+#define JOBS_DONE_RETENTION 1024
+
+/* With ANUBIS_JOB_OUTPUT set, a background job's stdout and stderr are
+ * captured in memfds (shmem, so swapped out rather than held in memory under
+ * pressure) and written out whole once it is done: between lines, so never
+ * into the middle of another command's output, or to files of its own. Jobs
+ * running together no longer interleave their output.
+ */
+
+typedef enum JobState {
+	JOB_RUNNING,
+	JOB_STOPPED,
+	JOB_DONE
+} JobState;
+
+extern const char* job_state_names[];
+
+// Resources used, as reported by wait4 (maxRss in KiB)
+typedef struct JobUsage {
+	struct timeval user;
+	struct timeval system;
+	long maxRss;
+	long voluntarySwitches;
+	long involuntarySwitches;
+} JobUsage;
+
+typedef struct JobProcess {
+	pid_t pid;
+	// Index of the command within its pipeline
+	size_t stage;
+	// Only live processes are signalled
+	bool exited;
+	int status;
+	JobUsage usage;
+} JobProcess;
+
+typedef struct Job {
+	int id;
+	JobState state;
+	bool background;
+	size_t processCount;
+	size_t processCapacity;
+	JobProcess* processes;
+	size_t remaining;
+	// Wait status of the last command in the pipeline
+	int status;
+	// Totals over every exited process, maxRss is the largest of them
+	JobUsage usage;
+	struct timespec started;
+	struct timespec finished;
+	char* description;
+	// Captured stdout and stderr, -1 when written directly
+	int capturedOut;
+	int capturedErr;
+} Job;
+
+Job* job_new(CommandLine* line);
+// Takes ownership of the heap allocated description
+Job* job_new_described(char* description, bool background);
+int job_add_process(Job* job, pid_t pid, size_t stage);
+// Blocks until every process in the job has exited or the job is stopped, reaping other jobs meanwhile
+int job_wait(Job* job);
+int job_continue(Job* job, bool background);
+void job_remove(Job* job);
+// Writes out and releases the job's captured output, if any
+void job_write_output(Job* job);
+
+Job* jobs_find(int id);
+// Most recently started job that has not finished, if any
+Job* jobs_current();
+// Background jobs currently running (stopped jobs do not hold a slot)
+size_t jobs_running_background();
+// Blocks until fewer than options.jobLimit background jobs are running
+void jobs_admit_background();
+// Reap any finished children without blocking
+void jobs_reap();
+// Blocks until a child exits or stops. 1: Reaped it, -1: No children remain
+int jobs_reap_next();
+// Blocks until no job is running, stopped jobs are left in the table
+int jobs_wait_all();
+// Print the table, finished jobs are dropped once reported
+void jobs_report();
+void jobs_prune();
+// Writes out the captured output of every finished job
+void jobs_write_output();
+void jobs_free();
+
+void job_usage_add(JobUsage* total, const JobUsage* usage);
+JobUsage job_usage_from(const struct rusage* usage);
+
+#endif // ANUBIS_JOBS_H
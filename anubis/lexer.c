@@ -3,6 +3,8 @@
 #include "checks.h"
 #include "mem_utils.h"
 #include "math_utils.h"
+#include "scan.h"
+#include "trace.h"
 #include "visibility.h"
 
 #include <errno.h>
@@ -15,15 +17,19 @@
 const char* token_names[] = {
 	[AMPERSAND] = "AMPERSAND",
 	[PIPE] = "PIPE",
+	[FAN_OUT] = "FAN_OUT",
 	[GREATER] = "GREATER",
+	[PROCESS_IN] = "PROCESS_IN",
+	[PROCESS_OUT] = "PROCESS_OUT",
+	[CLOSE_PAREN] = "CLOSE_PAREN",
 	[STRING] = "STRING",
 	[EOI] = "EOI"
 };
 
 LINKAGE_PUBLIC Lexer* lexer_new(char* source) {
 	Lexer* lexer = malloc(sizeof(*lexer));
+	INSTANCE_NULL_CHECK_RETURN("lexer", lexer, NULL);
 	lexer->source = NULL;
-	lexer->string = NULL;
 	lexer_reset(lexer, source);
 	return lexer;
 }
@@ -33,172 +39,149 @@ LINKAGE_PUBLIC void lexer_free(Lexer* lexer) {
 		// Invoked in shutdown hook, ignore null entries as they are already free
 		return;
 	}
-	checked_free(lexer->string);
-	checked_free(lexer->source);
+	// Source is borrowed from the caller
 	checked_free(lexer);
 }
 
 LINKAGE_PUBLIC int lexer_reset(Lexer* _this, char* source) {
-	_LEXER_NULL_CHECK_RETURN(_this, 0);
+	INSTANCE_NULL_CHECK_RETURN("lexer", _this, 0);
 	INSTANCE_NULL_CHECK_RETURN("source", source, 0);
-	checked_free(_this->source);
-	_this->source = strdup(source);
+	_this->source = source;
+	_this->source_len = strlen(source);
 	_this->pos = 0;
 	_this->symbol = -1;
-	_this->source_len = strlen(source);
-	if (_this->source_len == 0) {
-		ERROR(EINVAL, "Source must not be empty");
-		return 1;
-	}
-	_this->cchar = source[0];
-	_this->is_reading_string = false;
-	_this->string_len = 0;
-	_this->string_pos = 0;
-	if (_this->string != NULL) {
-		free(_this->string);
-		_this->string = NULL;
-	}
+	_this->slice = (TokenSlice) { 0 };
+	_this->depth = 0;
 	return 1;
 }
 
 LINKAGE_PUBLIC void lexer_print_state(Lexer* _this) {
 	fprintf(
 		stderr,
-		"STATE: {\n\tPOS: %zu\n\tCHAR: %c\n\tSYMBOL: %s\n\tSOURCE LEN: %zu\n\tSOURCE: %s\n\tIS READING STRING: %s\n\tSTRING LEN: %zu\n\tSTRING POS: %zu\n\tSTRING:%s\n}\n",
+		"STATE: {\n\tPOS: %zu\n\tSYMBOL: %s\n\tSOURCE LEN: %zu\n\tSOURCE: %s\n\tSLICE OFFSET: %zu\n\tSLICE LEN: %zu\n\tSLICE FLAGS: %d\n\tSLICE: %.*s\n}\n",
 		_this->pos,
-		_this->cchar,
-		token_names[_this->symbol],
+		_this->symbol < 0 ? "NONE" : token_names[_this->symbol],
 		_this->source_len,
 		_this->source,
-		_this->is_reading_string ? "true" : "false",
-		_this->string_len,
-		_this->string_pos,
-		_this->string
+		_this->slice.offset,
+		_this->slice.length,
+		_this->slice.flags,
+		(int) _this->slice.length,
+		&_this->source[_this->slice.offset]
 	);
 }
 
-// 0: Finished, 1: Ignore, Other: failure
-LINKAGE_PRIVATE int next_string(Lexer* _this) {
-	_LEXER_NULL_CHECK_RETURN(_this, -1);
-	if (_this->pos < _this->string_pos) {
-		return 0;
-	}
-	checked_free(_this->string);
-	size_t start = _this->string_pos;
-	size_t end = DEC_FLOOR(_this->pos);
-	_this->string = strndup(&_this->source[start], end - start);
-	_this->string_len = end - start;
-	if (_this->string == NULL) {
-		ERROR(ENOMEM, "Unable to extract string in tokenised sequence");
-		return ENOMEM;
+// Shift a run of token bytes down onto the write cursor, a no-op until the first quote/escape is stripped
+LINKAGE_TRANSPARENT void compact(Lexer* _this, size_t* write, size_t read, size_t len) {
+	if (*write != read) {
+		memmove(&_this->source[*write], &_this->source[read], len);
 	}
-	_this->is_reading_string = false;
-	return 1;
-}
-
-LINKAGE_TRANSPARENT void next_char(Lexer* _this) {
-	_this->cchar = _this->source[_this->pos++];
+	*write += len;
 }
 
-#define HANDLE_NEXT_STRING \
-	if (_this->is_reading_string) { \
-		res = next_string(_this); \
-		if (res == 1) { \
-			break; \
-		} else if (res != 1) { \
-			return res; \
-		} \
+__attribute__((hot))
+LINKAGE_PRIVATE void read_string(Lexer* _this) {
+	char* source = _this->source;
+	size_t len = _this->source_len;
+	size_t pos = _this->pos;
+	size_t write = pos;
+	int flags = 0;
+	_this->slice.offset = pos;
+	while (pos < len) {
+		char c = source[pos];
+		if (c == '\\') {
+			flags |= TOKEN_ESCAPED;
+			if (++pos < len) {
+				source[write++] = source[pos++];
+			}
+		} else if (c == '\'') {
+			// Everything up to the closing quote is literal
+			flags |= TOKEN_QUOTED;
+			pos++;
+			const char* close = memchr(&source[pos], '\'', len - pos);
+			size_t run = close == NULL ? len - pos : (size_t) (close - &source[pos]);
+			compact(_this, &write, pos, run);
+			pos += run + (close != NULL);
+		} else if (c == '"') {
+			// Literal apart from backslash escaping a quote or backslash
+			flags |= TOKEN_QUOTED;
+			pos++;
+			while (pos < len && source[pos] != '"') {
+				if (source[pos] == '\\' && pos + 1 < len && (source[pos + 1] == '"' || source[pos + 1] == '\\')) {
+					flags |= TOKEN_ESCAPED;
+					pos++;
+				}
+				source[write++] = source[pos++];
+			}
+			pos += pos < len;
+		} else if (c == _TOK_CLOSE && _this->depth == 0) {
+			// A delimiter only within a process substitution
+			compact(_this, &write, pos, 1);
+			pos++;
+		} else if (scan_is_delimiter(c)) {
+			break;
+		} else {
+			size_t run = scan_plain(&source[pos], len - pos);
+			compact(_this, &write, pos, run);
+			pos += run;
+		}
 	}
-
-#define SINGLE_TOKEN_CASE(literal, token, skipSequential) \
-	case literal:\
-		HANDLE_NEXT_STRING;\
-		next_char(_this);\
-		_this->symbol = (token);\
-		if (skipSequential && _this->pos < _this->source_len - 1 && _this->source[_this->pos + 1] == literal) {\
-			goto read;\
-		}\
-		break
-
-LINKAGE_TRANSPARENT void remove_char(Lexer* _this) {
-	memmove(&_this->source[_this->pos - 1], &_this->source[_this->pos], _this->source_len - _this->pos + 1);
-	_this->source_len--;
-	_this->pos--;
-	next_char(_this);
+	_this->pos = pos;
+	_this->slice.length = write - _this->slice.offset;
+	_this->slice.flags = flags;
 }
 
+// 0: End of input reached, 1: Token read
+__attribute__((hot))
 LINKAGE_PUBLIC int lexer_next_symbol(Lexer* _this) {
-	_LEXER_NULL_CHECK_RETURN(_this, -1);
-	if (_this->pos >= _this->source_len - 1) {
+	_LEXER_NULL_CHECK_RETURN(_this, 0);
+	uint64_t start = TRACE_BEGIN();
+	char* source = _this->source;
+	while (_this->pos < _this->source_len && (_IS_WHITESPACE(source[_this->pos]))) {
+		_this->pos++;
+	}
+	if (_this->pos >= _this->source_len || source[_this->pos] == '\0') {
 		_this->symbol = EOI;
+		TRACE_END(TRACE_LEX, start);
 		return 0;
 	}
-	int res;
-	bool escape = false;
-	bool single_quoted = false;
-	bool double_quoted = false;
-read:
-	switch (_this->cchar) {
-		case '\0':
-			HANDLE_NEXT_STRING;
-			_this->symbol = EOI;
+	char c = source[_this->pos];
+	if ((c == _TOK_LESS || c == _TOK_GREATER) && _this->pos + 1 < _this->source_len && source[_this->pos + 1] == _TOK_OPEN) {
+		_this->symbol = c == _TOK_LESS ? PROCESS_IN : PROCESS_OUT;
+		_this->pos += 2;
+		_this->depth++;
+		TRACE_END(TRACE_LEX, start);
+		return 1;
+	} else if (c == _TOK_CLOSE && _this->depth > 0) {
+		_this->symbol = CLOSE_PAREN;
+		_this->pos++;
+		_this->depth--;
+		TRACE_END(TRACE_LEX, start);
+		return 1;
+	}
+	switch (c) {
+		case _TOK_AMPERSAND:
+			_this->symbol = AMPERSAND;
+			_this->pos++;
 			break;
-		case ' ':
-		case '\t':
-		case '\n':
-			if (escape) {
-				next_char(_this);
-				escape = false;
-				goto read;
-			}
-			if (single_quoted || double_quoted) {
-				goto string;
-			}
-			HANDLE_NEXT_STRING
-			next_char(_this);
-			goto read;
-		SINGLE_TOKEN_CASE(EOF, EOI, false);
-		SINGLE_TOKEN_CASE(_TOK_AMPERSAND, AMPERSAND, true);
-		SINGLE_TOKEN_CASE(_TOK_PIPE, PIPE, false);
-		SINGLE_TOKEN_CASE(_TOK_GREATER, GREATER, false);
-		case '\\':
-			escape = true;
-			goto string;
-		case '"':
-			if (!escape) {
-				double_quoted = !double_quoted;
-				if (!double_quoted) {
-					remove_char(_this);
-				} else {
-					next_char(_this);
-				}
-				goto read;
+		case _TOK_PIPE:
+			_this->symbol = PIPE;
+			_this->pos++;
+			if (_this->pos < _this->source_len && source[_this->pos] == _TOK_AMPERSAND) {
+				_this->symbol = FAN_OUT;
+				_this->pos++;
 			}
-			goto string;
-		case '\'':
-			if (!escape) {
-				single_quoted = !single_quoted;
-				if (!double_quoted) {
-					remove_char(_this);
-				} else {
-					next_char(_this);
-				}
-				goto read;
-			}
-			goto string;
+			break;
+		case _TOK_GREATER:
+			_this->symbol = GREATER;
+			_this->pos++;
+			break;
 		default:
-string:
-			if (_this->is_reading_string) {
-				next_char(_this);
-				goto read;
-			}
-			_this->string_len = 0;
-			_this->string_pos = DEC_FLOOR(_this->pos);
-			_this->is_reading_string = true;
 			_this->symbol = STRING;
-			next_char(_this);
-			goto read;
+			read_string(_this);
+			break;
 	}
+	TRACE_END(TRACE_LEX, start);
 	return 1;
 }
 
@@ -207,7 +190,11 @@ LINKAGE_PUBLIC int lexer_current_symbol(Lexer* _this) {
 	return _this->symbol;
 }
 
-LINKAGE_PUBLIC char* lexer_current_string(Lexer* _this) {
+LINKAGE_PUBLIC TokenSlice lexer_current_slice(Lexer* _this) {
+	return _this->slice;
+}
+
+LINKAGE_PUBLIC const char* lexer_slice_start(Lexer* _this, TokenSlice* slice) {
 	_LEXER_NULL_CHECK_RETURN(_this, NULL);
-	return _this->string;
+	return &_this->source[slice->offset];
 }
@@ -7,6 +7,9 @@
 #define _TOK_AMPERSAND '&'
 #define _TOK_PIPE '|'
 #define _TOK_GREATER '>'
+#define _TOK_LESS '<'
+#define _TOK_OPEN '('
+#define _TOK_CLOSE ')'
 
 #define _IS_RESERVED(c) (c) == _TOK_AMPERSAND || (c) == _TOK_PIPE || (c) == _TOK_GREATER
 #define _IS_WHITESPACE(c) (c) == ' ' || (c) == '\t' || (c) == '\n'
@@ -15,7 +18,13 @@
 typedef enum Token {
 	AMPERSAND,
 	PIPE,
+	// |& feeding a copy of the pipeline's output to each command of a { , } list
+	FAN_OUT,
 	GREATER,
+	// <( and >( opening a process substitution, ended by CLOSE_PAREN
+	PROCESS_IN,
+	PROCESS_OUT,
+	CLOSE_PAREN,
 	STRING,
 	EOI
 } Token;
@@ -24,26 +33,40 @@ typedef enum Token {
 
 extern const char* token_names[];
 
-typedef struct __attribute__((__packed__)) Lexer {
+// Slice flags, describing how the token was written in the source
+#define TOKEN_QUOTED 0x1
+#define TOKEN_ESCAPED 0x2
+
+/* View of a STRING token within the lexer source. Quotes and escapes are
+ * stripped in place as the token is read, so the slice is the final value
+ * but is not NUL terminated (the byte after it may be the next operator).
+ */
+typedef struct TokenSlice {
+	size_t offset;
+	size_t length;
+	int flags;
+} TokenSlice;
+
+typedef struct Lexer {
 	size_t pos;
-	int cchar;
 	int symbol;
 	size_t source_len;
 	char* source;
-	bool is_reading_string;
-	size_t string_len;
-	size_t string_pos;
-	char* string;
+	TokenSlice slice;
+	// Process substitutions open, outside of one a ) is an ordinary character
+	size_t depth;
 } Lexer;
 
 Lexer* lexer_new(char* source);
 void lexer_free(Lexer* lexer);
 
+// The source is borrowed, not copied, and is rewritten in place while lexing
 int lexer_reset(Lexer* _this, char* source);
 int lexer_next_symbol(Lexer* _this);
 
 int lexer_current_symbol(Lexer* _this);
-char* lexer_current_string(Lexer* _this);
+TokenSlice lexer_current_slice(Lexer* _this);
+const char* lexer_slice_start(Lexer* _this, TokenSlice* slice);
 
 void lexer_print_state(Lexer* _this);
 
@@ -0,0 +1,84 @@
+#include "line_reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "mem_utils.h"
+#include "visibility.h"
+
+#define FAIL_COND -1
+
+LINKAGE_PUBLIC int line_reader_init(LineReader* reader, int fd, size_t capacity) {
+	*reader = (LineReader) { .fd = fd, .capacity = capacity };
+	if ((reader->buffer = malloc(capacity)) == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC void line_reader_free(LineReader* reader) {
+	checked_free(reader->buffer);
+	reader->buffer = NULL;
+}
+
+// Hands out [start, terminator) and consumes it along with the terminator
+LINKAGE_PRIVATE ssize_t take_line(LineReader* reader, char* terminator, char** line) {
+	*terminator = '\0';
+	*line = &reader->buffer[reader->start];
+	size_t consumed = terminator - *line + (reader->eof && terminator == &reader->buffer[reader->end] ? 0 : 1);
+	reader->start += consumed;
+	return (ssize_t) consumed;
+}
+
+// 0: Read some input or reached its end, Otherwise: errno of the failed read or allocation
+LINKAGE_PRIVATE int fill(LineReader* reader) {
+	if (reader->start > 0) {
+		// Keep the partial line at the front so the buffer only grows for long lines
+		memmove(reader->buffer, &reader->buffer[reader->start], reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	// One byte is always kept back to terminate an unterminated last line
+	if (reader->end + 1 >= reader->capacity) {
+		char* grown = realloc(reader->buffer, reader->capacity * 2);
+		if (grown == NULL) {
+			return ENOMEM;
+		}
+		reader->buffer = grown;
+		reader->capacity *= 2;
+	}
+	ssize_t count;
+	uint64_t start = TRACE_BEGIN();
+	while ((count = read(reader->fd, &reader->buffer[reader->end], reader->capacity - reader->end - 1)) == FAIL_COND
+		&& errno == EINTR);
+	TRACE_END(TRACE_READ, start);
+	if (count == FAIL_COND) {
+		return errno;
+	}
+	reader->eof = count == 0;
+	reader->end += count;
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC ssize_t line_reader_next(LineReader* reader, char** line) {
+	size_t scanned = reader->start;
+	for (;;) {
+		char* newline = memchr(&reader->buffer[scanned], '\n', reader->end - scanned);
+		if (newline != NULL) {
+			return take_line(reader, newline, line);
+		} else if (reader->eof) {
+			return reader->start == reader->end ? 0 : take_line(reader, &reader->buffer[reader->end], line);
+		}
+		// Only the newly read bytes need scanning
+		scanned = reader->end - reader->start;
+		int err;
+		if ((err = fill(reader))) {
+			errno = err;
+			return FAIL_COND;
+		}
+	}
+}
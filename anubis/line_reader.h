@@ -0,0 +1,33 @@
+#ifndef ANUBIS_LINE_READER_H
+#define ANUBIS_LINE_READER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define LINE_READER_DEFAULT_CAPACITY (64 * 1024)
+
+/* Lines of a non-interactive command stream (anubis -), read with large
+ * read(...) calls into one buffer and handed out in place. Lines longer than
+ * the buffer grow it. Commands started from the stream share its descriptor,
+ * and only see the input the shell has not yet buffered.
+ */
+typedef struct LineReader {
+	int fd;
+	char* buffer;
+	size_t capacity;
+	// Unconsumed input is [start, end)
+	size_t start;
+	size_t end;
+	bool eof;
+} LineReader;
+
+int line_reader_init(LineReader* reader, int fd, size_t capacity);
+void line_reader_free(LineReader* reader);
+
+/* -1: Read failed (errno is set), 0: End of input, Otherwise: bytes consumed.
+ * line is NUL terminated without its newline, valid until the next call
+ */
+ssize_t line_reader_next(LineReader* reader, char** line);
+
+#endif // ANUBIS_LINE_READER_H
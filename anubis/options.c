@@ -0,0 +1,252 @@
+#include "options.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "trace.h"
+#include "visibility.h"
+
+#define ENV_SPAWN "ANUBIS_SPAWN"
+#define ENV_SCAN "ANUBIS_SCAN"
+#define ENV_UTILITIES "ANUBIS_UTILITIES"
+#define ENV_ZERO_COPY "ANUBIS_ZERO_COPY"
+#define ENV_PIPE_SIZE "ANUBIS_PIPE_SIZE"
+#define ENV_ACCOUNTING "ANUBIS_ACCOUNTING"
+#define ENV_SCRIPT_CACHE "ANUBIS_SCRIPT_CACHE"
+#define ENV_PARSE_AHEAD "ANUBIS_PARSE_AHEAD"
+#define ENV_PARSE_THREADS "ANUBIS_PARSE_THREADS"
+// Smaller scripts parse faster than threads start
+#define PARSE_THREADS_AUTO_SIZE (4 << 20)
+#define ENV_PARALLEL_LINES "ANUBIS_PARALLEL_LINES"
+#define ENV_JOB_OUTPUT "ANUBIS_JOB_OUTPUT"
+#define ENV_TRACE "ANUBIS_TRACE"
+#define ENV_TRACE_FILE "ANUBIS_TRACE_FILE"
+
+Options options = {
+	.spawnEngine = SPAWN_ENGINE_POSIX,
+	.scanImpl = SCAN_IMPL_AUTO,
+	.jobLimit = 1,
+	.utilities = true,
+	.zeroCopy = true,
+	.pipeSizing = PIPE_SIZING_DEFAULT,
+	.pipeSize = 0,
+	.accounting = NULL,
+	.trace = false,
+	.traceFile = NULL,
+	.scriptCache = NULL,
+	.parseAhead = 0,
+	.parseThreads = 1,
+	.parseThreadsMinSize = PARSE_THREADS_AUTO_SIZE,
+	.parallelLines = 0,
+	.jobOutput = JOB_OUTPUT_DIRECT,
+	.jobOutputDir = NULL,
+	.commands = NULL,
+	.serve = NULL,
+	.connect = NULL
+};
+
+LINKAGE_PRIVATE int parse_spawn_engine(const char* value, SpawnEngine* engine) {
+	if (strcmp(value, "posix") == 0) {
+		*engine = SPAWN_ENGINE_POSIX;
+	} else if (strcmp(value, "fork") == 0) {
+		*engine = SPAWN_ENGINE_FORK;
+	} else if (strcmp(value, "zygote") == 0) {
+		*engine = SPAWN_ENGINE_ZYGOTE;
+	} else {
+		return EINVAL;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE int parse_scan_impl(const char* value, ScanImpl* impl) {
+	for (ScanImpl i = SCAN_IMPL_AUTO; i <= SCAN_IMPL_AVX2; i++) {
+		if (strcmp(value, scan_impl_names[i]) == 0) {
+			*impl = i;
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+LINKAGE_PRIVATE int parse_switch(const char* value, bool* enabled) {
+	if (strcmp(value, "on") == 0) {
+		*enabled = true;
+	} else if (strcmp(value, "off") == 0) {
+		*enabled = false;
+	} else {
+		return EINVAL;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE int parse_pipe_size(const char* value, PipeSizing* sizing, size_t* size) {
+	if (strcmp(value, "default") == 0) {
+		*sizing = PIPE_SIZING_DEFAULT;
+		return 0;
+	} else if (strcmp(value, "adaptive") == 0) {
+		*sizing = PIPE_SIZING_ADAPTIVE;
+		return 0;
+	}
+	char* end;
+	long bytes = strtol(value, &end, 10);
+	switch (*end) {
+		case 'k': case 'K': bytes <<= 10; end++; break;
+		case 'm': case 'M': bytes <<= 20; end++; break;
+	}
+	if (*value == '\0' || *end != '\0' || bytes <= 0) {
+		return EINVAL;
+	}
+	*sizing = PIPE_SIZING_FIXED;
+	*size = (size_t) bytes;
+	return 0;
+}
+
+LINKAGE_PRIVATE int parse_threads(const char* value, size_t cores, size_t* threads, size_t* minSize) {
+	if (strcmp(value, "auto") == 0) {
+		*threads = cores;
+		*minSize = PARSE_THREADS_AUTO_SIZE;
+	} else if (strcmp(value, "off") == 0) {
+		*threads = 0;
+	} else if ((*threads = options_parse_count(value)) > 0) {
+		// Explicitly requested, used whatever the script's size
+		*minSize = 0;
+	} else {
+		return EINVAL;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE int parse_parallel_lines(const char* value, size_t cores, size_t* lines) {
+	if (strcmp(value, "auto") == 0) {
+		*lines = cores;
+	} else if (strcmp(value, "off") == 0) {
+		*lines = 0;
+	} else if ((*lines = options_parse_count(value)) == 0) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE int parse_job_output(const char* value, JobOutput* output, const char** dir) {
+	if (strcmp(value, "direct") == 0) {
+		*output = JOB_OUTPUT_DIRECT;
+	} else if (strcmp(value, "capture") == 0) {
+		*output = JOB_OUTPUT_CAPTURE;
+	} else if (*value != '\0') {
+		// Anything else names the directory the files are written to
+		*output = JOB_OUTPUT_CAPTURE;
+		*dir = value;
+	} else {
+		return EINVAL;
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC size_t options_parse_count(const char* value) {
+	char* end;
+	long count = strtol(value, &end, 10);
+	if (*value == '\0' || *end != '\0' || count <= 0) {
+		return 0;
+	}
+	return (size_t) count;
+}
+
+LINKAGE_PUBLIC int options_init() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	options.jobLimit = cores > 0 ? (size_t) cores : 1;
+	options.parseThreads = options.jobLimit;
+	char* value;
+	if ((value = getenv(ENV_SPAWN)) != NULL && parse_spawn_engine(value, &options.spawnEngine)) {
+		ERROR(EINVAL, "Unknown spawn engine %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_SCAN)) != NULL && parse_scan_impl(value, &options.scanImpl)) {
+		ERROR(EINVAL, "Unknown scanner %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_UTILITIES)) != NULL && parse_switch(value, &options.utilities)) {
+		ERROR(EINVAL, "Unknown utilities setting %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_ZERO_COPY)) != NULL && parse_switch(value, &options.zeroCopy)) {
+		ERROR(EINVAL, "Unknown zero copy setting %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_PIPE_SIZE)) != NULL && parse_pipe_size(value, &options.pipeSizing, &options.pipeSize)) {
+		ERROR(EINVAL, "Unknown pipe size %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_ACCOUNTING)) != NULL && *value != '\0') {
+		options.accounting = value;
+	}
+	if ((value = getenv(ENV_SCRIPT_CACHE)) != NULL && *value != '\0') {
+		options.scriptCache = value;
+	}
+	if ((value = getenv(ENV_PARSE_AHEAD)) != NULL && strcmp(value, "off") != 0
+		&& (options.parseAhead = options_parse_count(value)) == 0) {
+		ERROR(EINVAL, "Unknown parse ahead depth %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_PARSE_THREADS)) != NULL
+		&& parse_threads(value, options.jobLimit, &options.parseThreads, &options.parseThreadsMinSize)) {
+		ERROR(EINVAL, "Unknown parse threads %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_PARALLEL_LINES)) != NULL && parse_parallel_lines(value, options.jobLimit, &options.parallelLines)) {
+		ERROR(EINVAL, "Unknown parallel lines %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_JOB_OUTPUT)) != NULL && parse_job_output(value, &options.jobOutput, &options.jobOutputDir)) {
+		ERROR(EINVAL, "Unknown job output %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_TRACE)) != NULL && parse_switch(value, &options.trace)) {
+		ERROR(EINVAL, "Unknown trace setting %s", value);
+		return EINVAL;
+	}
+	if ((value = getenv(ENV_TRACE_FILE)) != NULL && *value != '\0') {
+		options.trace = true;
+		options.traceFile = value;
+	}
+	options.scanImpl = scan_init(options.scanImpl);
+	if (options.trace) {
+		return trace_init(options.traceFile);
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC int options_parse_args(int argc, char** argv) {
+	int opt;
+	// Report through ERROR rather than getopt's own messages
+	opterr = 0;
+	// Stop at the first operand, the script name
+	while ((opt = getopt(argc, argv, "+C:S:c:j:p:")) != -1) {
+		switch (opt) {
+			case 'C':
+				options.connect = optarg;
+				break;
+			case 'S':
+				options.serve = optarg;
+				break;
+			case 'c':
+				options.commands = optarg;
+				break;
+			case 'j':
+				if ((options.jobLimit = options_parse_count(optarg)) == 0) {
+					return -1;
+				}
+				break;
+			case 'p':
+				if (parse_pipe_size(optarg, &options.pipeSizing, &options.pipeSize)) {
+					return -1;
+				}
+				break;
+			default:
+				return -1;
+		}
+	}
+	return optind;
+}
@@ -0,0 +1,96 @@
+#ifndef ANUBIS_OPTIONS_H
+#define ANUBIS_OPTIONS_H
+
+/* Runtime options, populated from ANUBIS_* environment variables and flags at startup:
+ *
+ * -c COMMANDS  Run these newline separated commands instead of a script
+ * -S SOCKET  Serve command lines to clients connecting to this Unix socket (see server.h)
+ * -C SOCKET  Run the commands on the server listening on this socket, exiting with the last status
+ * -j N  Maximum background pipelines running at once (default: online CPU count)
+ * -p SIZE  Pipe buffer sizing, as ANUBIS_PIPE_SIZE
+ *
+ * ANUBIS_SPAWN=posix|fork|zygote  Engine used to launch external commands (default: posix)
+ * ANUBIS_SCAN=auto|scalar|sse2|avx2  Lexer delimiter scanner (default: auto, widest supported)
+ * ANUBIS_UTILITIES=on|off  Run echo, cat, printf, wc, true and false in-process (default: on)
+ * ANUBIS_ZERO_COPY=on|off  Splice/sendfile data moved by in-process utilities (default: on)
+ * ANUBIS_ACCOUNTING=stderr|<file>  Append a resource summary of every line (default: off)
+ * ANUBIS_SCRIPT_CACHE=<dir>  Compile batch scripts once and reuse them from this directory (default: off)
+ * ANUBIS_PARSE_AHEAD=off|<lines>  Parse batch scripts on a second thread, up to this many lines ahead (default: off)
+ * ANUBIS_PARSE_THREADS=auto|off|<threads>  Parse large batch scripts in parallel chunks (default: auto, one per CPU for scripts of 4MiB or more)
+ * ANUBIS_JOB_OUTPUT=direct|capture|<dir>  Background job output written as it is produced, or captured and
+ *   written out whole once the job is done, to the shell's stdout and stderr or to <dir>/<id>.out and .err (default: direct)
+ * ANUBIS_PARALLEL_LINES=auto|off|<lines>  Run independent batch lines concurrently, see concurrent.h (default: off, auto: one per CPU)
+ * ANUBIS_TRACE=on|off  Time the shell's own phases, histograms are printed at exit (default: off)
+ * ANUBIS_TRACE_FILE=<path>  Write those phases as Chrome trace JSON (implies ANUBIS_TRACE=on)
+ * ANUBIS_PIPE_SIZE=default|adaptive|<bytes>[k|m]  Inter-stage pipe capacity (default: kernel default)
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "scan.h"
+
+typedef enum SpawnEngine {
+	SPAWN_ENGINE_POSIX,
+	SPAWN_ENGINE_FORK,
+	// Forked by a helper started with the shell, see zygote.h
+	SPAWN_ENGINE_ZYGOTE
+} SpawnEngine;
+
+typedef enum PipeSizing {
+	PIPE_SIZING_DEFAULT,
+	PIPE_SIZING_FIXED,
+	PIPE_SIZING_ADAPTIVE
+} PipeSizing;
+
+typedef enum JobOutput {
+	JOB_OUTPUT_DIRECT,
+	// Captured in memory, see jobs.h
+	JOB_OUTPUT_CAPTURE
+} JobOutput;
+
+typedef struct Options {
+	SpawnEngine spawnEngine;
+	ScanImpl scanImpl;
+	size_t jobLimit;
+	bool utilities;
+	bool zeroCopy;
+	PipeSizing pipeSizing;
+	size_t pipeSize;
+	// NULL: No summary, Otherwise: stderr or the file appended to
+	const char* accounting;
+	bool trace;
+	// NULL: No trace file
+	const char* traceFile;
+	// NULL: Batch scripts are parsed line by line as they are read
+	const char* scriptCache;
+	// 0: Batch lines are parsed by the thread executing them
+	size_t parseAhead;
+	// 0: Batch scripts are never parsed in parallel
+	size_t parseThreads;
+	// Smallest script parsed in parallel
+	size_t parseThreadsMinSize;
+	// 0: Batch lines run one after another
+	size_t parallelLines;
+	JobOutput jobOutput;
+	// NULL: Captured job output goes to the shell's stdout and stderr
+	const char* jobOutputDir;
+	// NULL: Commands come from the script or stdin
+	char* commands;
+	// NULL: Not serving, Otherwise: socket to listen on
+	const char* serve;
+	// NULL: Commands run locally, Otherwise: socket of the server running them
+	const char* connect;
+} Options;
+
+extern Options options;
+
+#define OPTIONS_USAGE "usage: anubis [-j jobs] [-p pipe-size] [-S socket | -C socket] [-c commands | script | -]"
+
+int options_init();
+// -1: Invalid arguments, Otherwise: index of the first operand
+int options_parse_args(int argc, char** argv);
+// 0: Invalid, Otherwise: the parsed positive count
+size_t options_parse_count(const char* value);
+
+#endif // ANUBIS_OPTIONS_H
@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+#include "parse_ahead.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "error.h"
+#include "lexer.h"
+#include "parser.h"
+#include "trace.h"
+#include "thread.h"
+#include "mem_utils.h"
+#include "visibility.h"
+
+/* Ring of depth + 1 slots: the consumer holds the slot at head while its line
+ * executes, the reader fills the slot at tail. count includes the held slot,
+ * so the reader never overwrites a table that is still in use.
+ */
+struct ParseAhead {
+	FILE* stream;
+	pthread_t reader;
+	pthread_mutex_t lock;
+	pthread_cond_t notFull;
+	pthread_cond_t notEmpty;
+	ParsedLine* slots;
+	size_t slotCount;
+	size_t head;
+	size_t tail;
+	size_t count;
+	bool holding;
+	bool eof;
+	bool stopping;
+};
+
+// false: Stopped while waiting for a free slot
+LINKAGE_PRIVATE bool acquire_slot(ParseAhead* ahead, ParsedLine** slot) {
+	pthread_mutex_lock(&ahead->lock);
+	while (ahead->count == ahead->slotCount && !ahead->stopping) {
+		pthread_cond_wait(&ahead->notFull, &ahead->lock);
+	}
+	bool stopping = ahead->stopping;
+	*slot = &ahead->slots[ahead->tail];
+	pthread_mutex_unlock(&ahead->lock);
+	return !stopping;
+}
+
+LINKAGE_PRIVATE void publish_slot(ParseAhead* ahead, bool eof) {
+	pthread_mutex_lock(&ahead->lock);
+	if (eof) {
+		ahead->eof = true;
+	} else {
+		ahead->tail = (ahead->tail + 1) % ahead->slotCount;
+		ahead->count++;
+	}
+	pthread_cond_signal(&ahead->notEmpty);
+	pthread_mutex_unlock(&ahead->lock);
+}
+
+LINKAGE_PRIVATE void* reader_main(void* context) {
+	ParseAhead* ahead = context;
+	Lexer lexer;
+	ParsedLine* slot;
+	while (acquire_slot(ahead, &slot)) {
+		uint64_t start = TRACE_BEGIN();
+		ssize_t count = getline(&slot->line, &slot->len, ahead->stream);
+		TRACE_END(TRACE_READ, start);
+		if (count <= 0) {
+			publish_slot(ahead, true);
+			break;
+		}
+		// Raised by the consumer when it reaches the line, keeping stderr in order
+		arena_reset(slot->arena);
+		slot->errors = (ErrorSink) { .arena = slot->arena };
+		error_capture(&slot->errors);
+		Parser parser = parser_default(slot->arena);
+		lexer_reset(&lexer, slot->line);
+		start = TRACE_BEGIN();
+		slot->table = parse(&parser, &lexer);
+		TRACE_END(TRACE_PARSE, start);
+		error_capture(NULL);
+		publish_slot(ahead, false);
+	}
+	return NULL;
+}
+
+LINKAGE_PRIVATE void slots_free(ParsedLine* slots, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		arena_free(slots[i].arena);
+		checked_free(slots[i].line);
+	}
+	free(slots);
+}
+
+LINKAGE_PUBLIC ParseAhead* parse_ahead_start(FILE* stream, size_t depth) {
+	ParseAhead* ahead = calloc(1, sizeof(*ahead));
+	if (ahead == NULL) {
+		return NULL;
+	}
+	ahead->stream = stream;
+	ahead->slotCount = depth + 1;
+	if ((ahead->slots = calloc(ahead->slotCount, sizeof(*ahead->slots))) == NULL) {
+		free(ahead);
+		return NULL;
+	}
+	for (size_t i = 0; i < ahead->slotCount; i++) {
+		if ((ahead->slots[i].arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE)) == NULL) {
+			slots_free(ahead->slots, ahead->slotCount);
+			free(ahead);
+			return NULL;
+		}
+	}
+	pthread_mutex_init(&ahead->lock, NULL);
+	pthread_cond_init(&ahead->notFull, NULL);
+	pthread_cond_init(&ahead->notEmpty, NULL);
+	int err = thread_start(&ahead->reader, reader_main, ahead);
+	if (err) {
+		ERROR(err, "Unable to start the parse ahead reader");
+		pthread_cond_destroy(&ahead->notEmpty);
+		pthread_cond_destroy(&ahead->notFull);
+		pthread_mutex_destroy(&ahead->lock);
+		slots_free(ahead->slots, ahead->slotCount);
+		free(ahead);
+		return NULL;
+	}
+	return ahead;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC ParsedLine* parse_ahead_next(ParseAhead* ahead) {
+	pthread_mutex_lock(&ahead->lock);
+	if (ahead->holding) {
+		// The previous line has been executed, its slot can be refilled
+		ahead->head = (ahead->head + 1) % ahead->slotCount;
+		ahead->count--;
+		ahead->holding = false;
+		pthread_cond_signal(&ahead->notFull);
+	}
+	while (ahead->count == 0 && !ahead->eof) {
+		pthread_cond_wait(&ahead->notEmpty, &ahead->lock);
+	}
+	ParsedLine* slot = NULL;
+	if (ahead->count > 0) {
+		slot = &ahead->slots[ahead->head];
+		ahead->holding = true;
+	}
+	pthread_mutex_unlock(&ahead->lock);
+	return slot;
+}
+
+LINKAGE_PUBLIC void parse_ahead_stop(ParseAhead* ahead) {
+	if (ahead == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&ahead->lock);
+	ahead->stopping = true;
+	pthread_cond_signal(&ahead->notFull);
+	pthread_mutex_unlock(&ahead->lock);
+	pthread_join(ahead->reader, NULL);
+	pthread_cond_destroy(&ahead->notEmpty);
+	pthread_cond_destroy(&ahead->notFull);
+	pthread_mutex_destroy(&ahead->lock);
+	slots_free(ahead->slots, ahead->slotCount);
+	free(ahead);
+}
@@ -0,0 +1,38 @@
+#ifndef ANUBIS_PARSE_AHEAD_H
+#define ANUBIS_PARSE_AHEAD_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "error.h"
+#include "structure.h"
+
+/* Batch scripts read and parsed on a separate thread, overlapping the
+ * front end with execution. The reader streams lines into a bounded queue of
+ * parsed tables, at most depth lines ahead of the one being executed. Errors
+ * raised while parsing are deferred and replayed by the consumer in line order.
+ */
+
+typedef struct ParsedLine {
+	// Owns the table, reset when the slot is refilled
+	Arena* arena;
+	// NULL: the line failed to parse
+	CommandTable* table;
+	// Deferred errors to raise before executing the line, their messages are in the arena
+	ErrorSink errors;
+	// Line buffer the table's words point into
+	char* line;
+	size_t len;
+} ParsedLine;
+
+typedef struct ParseAhead ParseAhead;
+
+// NULL: Unable to start the reader, the stream is left to the caller
+ParseAhead* parse_ahead_start(FILE* stream, size_t depth);
+// NULL: End of input, Otherwise: the next line, valid until the following call
+ParsedLine* parse_ahead_next(ParseAhead* ahead);
+// Stops and joins the reader, the stream is not closed
+void parse_ahead_stop(ParseAhead* ahead);
+
+#endif // ANUBIS_PARSE_AHEAD_H
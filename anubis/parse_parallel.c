@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+
+#include "parse_parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "arena.h"
+#include "lexer.h"
+#include "parser.h"
+#include "trace.h"
+#include "thread.h"
+#include "visibility.h"
+
+// Chunks parsed ahead of the one executing, per worker
+#define CHUNKS_PER_WORKER 2
+
+typedef struct ChunkLine {
+	CommandTable* table;
+	ErrorSink errors;
+} ChunkLine;
+
+typedef struct Chunk {
+	// Whole lines of the mapping, [start, end)
+	char* start;
+	char* end;
+	// NULL until claimed, owns the chunk's lines and tables
+	Arena* arena;
+	ChunkLine* lines;
+	size_t lineCount;
+	bool done;
+	// 0: Parsed, Otherwise: errno of the failed allocation
+	int err;
+} Chunk;
+
+struct ParallelScript {
+	char* map;
+	size_t mapSize;
+	Chunk* chunks;
+	size_t chunkCount;
+	pthread_t* workers;
+	size_t workerCount;
+	size_t window;
+	pthread_mutex_t lock;
+	pthread_cond_t claimable;
+	pthread_cond_t completed;
+	// Next chunk to hand to a worker
+	size_t claimed;
+	// Chunk being executed and its next line
+	size_t current;
+	size_t line;
+	bool stopping;
+};
+
+/* Private, writable mapping with at least one zero byte after the script: the
+ * lines are terminated and lexed in place, copying only the pages touched.
+ * A file mapping cannot extend past the page holding its last byte, so an
+ * anonymous reservation one byte longer is laid down first and the file
+ * mapped over it.
+ */
+LINKAGE_PRIVATE char* map_script(int fd, size_t size, size_t* mapSize) {
+	*mapSize = size + 1;
+	char* map = mmap(NULL, *mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	if (mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(map, *mapSize);
+		return NULL;
+	}
+	madvise(map, size, MADV_WILLNEED);
+	return map;
+}
+
+// Cuts the script after the first newline at or past every chunk size multiple
+LINKAGE_PRIVATE int split_chunks(ParallelScript* parallel, size_t size) {
+	size_t capacity = size / PARSE_PARALLEL_CHUNK_SIZE + 1;
+	if ((parallel->chunks = calloc(capacity, sizeof(*parallel->chunks))) == NULL) {
+		return ENOMEM;
+	}
+	char* end = parallel->map + size;
+	char* start = parallel->map;
+	while (start < end) {
+		char* cut = start + PARSE_PARALLEL_CHUNK_SIZE < end ? start + PARSE_PARALLEL_CHUNK_SIZE : end;
+		char* newline = cut < end ? memchr(cut, '\n', end - cut) : NULL;
+		cut = newline == NULL ? end : newline + 1;
+		parallel->chunks[parallel->chunkCount++] = (Chunk) { .start = start, .end = cut };
+		start = cut;
+	}
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE void parse_chunk(Chunk* chunk) {
+	size_t count = 0;
+	for (char* at = chunk->start; at < chunk->end; count++) {
+		char* newline = memchr(at, '\n', chunk->end - at);
+		at = newline == NULL ? chunk->end : newline + 1;
+	}
+	chunk->lines = arena_calloc(chunk->arena, count, sizeof(*chunk->lines));
+	Parser parser = parser_default(chunk->arena);
+	Lexer lexer;
+	char* at = chunk->start;
+	for (size_t i = 0; i < count && chunk->lines != NULL; i++) {
+		char* newline = memchr(at, '\n', chunk->end - at);
+		char* next = newline == NULL ? chunk->end : newline + 1;
+		// The mapping has a zero past the script, an unterminated last line is already terminated
+		if (newline != NULL) {
+			*newline = '\0';
+		}
+		chunk->lines[i].errors = (ErrorSink) { .arena = chunk->arena };
+		error_capture(&chunk->lines[i].errors);
+		lexer_reset(&lexer, at);
+		uint64_t start = TRACE_BEGIN();
+		chunk->lines[i].table = parse(&parser, &lexer);
+		TRACE_END(TRACE_PARSE, start);
+		error_capture(NULL);
+		at = next;
+	}
+	chunk->lineCount = chunk->lines == NULL ? 0 : count;
+	chunk->err = chunk->lines == NULL && count > 0 ? ENOMEM : 0;
+}
+
+LINKAGE_PRIVATE void* worker_main(void* context) {
+	ParallelScript* parallel = context;
+	pthread_mutex_lock(&parallel->lock);
+	for (;;) {
+		// Bounded so memory stays proportional to the workers rather than the script
+		while (!parallel->stopping && parallel->claimed < parallel->chunkCount
+			&& parallel->claimed >= parallel->current + parallel->window) {
+			pthread_cond_wait(&parallel->claimable, &parallel->lock);
+		}
+		if (parallel->stopping || parallel->claimed == parallel->chunkCount) {
+			break;
+		}
+		Chunk* chunk = &parallel->chunks[parallel->claimed++];
+		pthread_mutex_unlock(&parallel->lock);
+		if ((chunk->arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE)) != NULL) {
+			parse_chunk(chunk);
+		} else {
+			chunk->err = ENOMEM;
+		}
+		pthread_mutex_lock(&parallel->lock);
+		chunk->done = true;
+		pthread_cond_broadcast(&parallel->completed);
+	}
+	pthread_mutex_unlock(&parallel->lock);
+	return NULL;
+}
+
+LINKAGE_PRIVATE int start_workers(ParallelScript* parallel, size_t threads) {
+	size_t count = threads < parallel->chunkCount ? threads : parallel->chunkCount;
+	if ((parallel->workers = calloc(count, sizeof(*parallel->workers))) == NULL) {
+		return ENOMEM;
+	}
+	parallel->window = count * CHUNKS_PER_WORKER;
+	int err = 0;
+	for (; parallel->workerCount < count; parallel->workerCount++) {
+		if ((err = thread_start(&parallel->workers[parallel->workerCount], worker_main, parallel))) {
+			break;
+		}
+	}
+	// Any worker makes progress, fewer only lose parallelism
+	return parallel->workerCount > 0 || count == 0 ? 0 : err;
+}
+
+LINKAGE_PUBLIC ParallelScript* parse_parallel_open(const char* script, size_t threads, size_t minSize) {
+	int fd = open(script, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat info;
+	if (fstat(fd, &info) || !S_ISREG(info.st_mode) || (size_t) info.st_size < minSize || info.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	ParallelScript* parallel = calloc(1, sizeof(*parallel));
+	if (parallel == NULL) {
+		close(fd);
+		return NULL;
+	}
+	pthread_mutex_init(&parallel->lock, NULL);
+	pthread_cond_init(&parallel->claimable, NULL);
+	pthread_cond_init(&parallel->completed, NULL);
+	uint64_t start = TRACE_BEGIN();
+	parallel->map = map_script(fd, (size_t) info.st_size, &parallel->mapSize);
+	TRACE_END(TRACE_READ, start);
+	close(fd);
+	int err;
+	if (parallel->map == NULL
+		|| (err = split_chunks(parallel, (size_t) info.st_size))
+		|| (err = start_workers(parallel, threads))) {
+		parse_parallel_close(parallel);
+		return NULL;
+	}
+	return parallel;
+}
+
+LINKAGE_PUBLIC void parse_parallel_close(ParallelScript* parallel) {
+	if (parallel == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&parallel->lock);
+	parallel->stopping = true;
+	pthread_cond_broadcast(&parallel->claimable);
+	pthread_mutex_unlock(&parallel->lock);
+	for (size_t i = 0; i < parallel->workerCount; i++) {
+		pthread_join(parallel->workers[i], NULL);
+	}
+	for (size_t i = 0; i < parallel->chunkCount; i++) {
+		arena_free(parallel->chunks[i].arena);
+	}
+	if (parallel->map != NULL) {
+		munmap(parallel->map, parallel->mapSize);
+	}
+	pthread_cond_destroy(&parallel->completed);
+	pthread_cond_destroy(&parallel->claimable);
+	pthread_mutex_destroy(&parallel->lock);
+	free(parallel->workers);
+	free(parallel->chunks);
+	free(parallel);
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC bool parse_parallel_next(ParallelScript* parallel, CommandTable** table, ErrorSink* errors) {
+	while (parallel->current < parallel->chunkCount) {
+		Chunk* chunk = &parallel->chunks[parallel->current];
+		pthread_mutex_lock(&parallel->lock);
+		while (!chunk->done) {
+			pthread_cond_wait(&parallel->completed, &parallel->lock);
+		}
+		pthread_mutex_unlock(&parallel->lock);
+		if (chunk->err) {
+			// Lines cannot be skipped, the rest of the script is abandoned
+			ERROR(chunk->err, "Unable to parse script chunk %zu", parallel->current);
+			return false;
+		}
+		if (parallel->line < chunk->lineCount) {
+			ChunkLine* line = &chunk->lines[parallel->line++];
+			*table = line->table;
+			*errors = line->errors;
+			return true;
+		}
+		// Executed, release the chunk and let the workers move the window on
+		arena_free(chunk->arena);
+		chunk->arena = NULL;
+		parallel->line = 0;
+		pthread_mutex_lock(&parallel->lock);
+		parallel->current++;
+		pthread_cond_broadcast(&parallel->claimable);
+		pthread_mutex_unlock(&parallel->lock);
+	}
+	return false;
+}
@@ -0,0 +1,31 @@
+#ifndef ANUBIS_PARSE_PARALLEL_H
+#define ANUBIS_PARSE_PARALLEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "error.h"
+#include "structure.h"
+
+/* Large batch scripts parsed by a pool of threads. The script is mapped
+ * privately and cut at newlines into chunks, which workers lex and parse in
+ * place into per chunk arenas. Chunks are handed out in program order as each
+ * one completes, so execution starts after the first chunk rather than the
+ * whole file. Parse errors are deferred, as with the script cache.
+ */
+
+#define PARSE_PARALLEL_CHUNK_SIZE (1 << 20)
+
+typedef struct ParallelScript ParallelScript;
+
+// NULL: Unable to map the script or smaller than minSize, parse it line by line instead
+ParallelScript* parse_parallel_open(const char* script, size_t threads, size_t minSize);
+void parse_parallel_close(ParallelScript* parallel);
+
+/* Next input line in program order, the table stays valid until the next call.
+ * false: End of script, Otherwise: table is NULL if the line failed to parse,
+ * errors holds the deferred errors to raise
+ */
+bool parse_parallel_next(ParallelScript* parallel, CommandTable** table, ErrorSink* errors);
+
+#endif // ANUBIS_PARSE_PARALLEL_H
@@ -3,7 +3,11 @@
  * =================================================
  * GOAL: CommandList;
  *
- * Args: <STRING>*;
+ * Substitution:
+ *		| <PROCESS_IN> PipeList <CLOSE_PAREN>
+ *		| <PROCESS_OUT> PipeList <CLOSE_PAREN>;
+ *
+ * Args: (<STRING> | Substitution)*;
  *
  * Command: <STRING> Args;
  *
@@ -11,6 +15,12 @@
  *		| <PIPE> Command PipeList
  *		| Command;
  *
+ * Branches:
+ *		| "," Command Branches
+ *		| "}";
+ *
+ * FanOut: (<FAN_OUT> "{" Command Branches)?; (unquoted { , } words, each branch's Args end at the next one, a word fused with one is an error)
+ *
  * IoModifier:
  *		| <GREATER> <STRING>;
  *
@@ -18,7 +28,9 @@
  *
  * BackgroundOp: <AMPERSAND>?;
  *
- * CommandLine: PipeList IoModifiers BackgroundOp;
+ * Timed: "time"?; (an unquoted time word starting the line, the pipe list may then be empty)
+ *
+ * CommandLine: Timed PipeList FanOut IoModifiers BackgroundOp;
  *
  * CommandList: CommandLine*;
  * =================================================
@@ -29,29 +41,110 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <errno.h>
+#include <string.h>
 
 #include "error.h"
 #include "checks.h"
+#include "arena.h"
+#include "math_utils.h"
 #include "lexer.h"
 #include "structure.h"
 #include "visibility.h"
 
-Parser parser_default() {
+Parser parser_default(Arena* arena) {
 	return (Parser) {
+		.arena = arena,
 		.arg_list_base_size = DEFAULT_ARG_LIST_SIZE,
 		.pipes_list_base_size = DEFAULT_PIPES_LIST_SIZE,
 		.command_list_base_size = DEFAULT_COMMAND_LIST_SIZE,
 	};
 }
 
+/* Grows geometrically (by at least bump): a list only grows in place while it is
+ * the arena's latest allocation, which the strings parsed into it never leave it
+ */
 #define HANDLED_REALLOC(target, bump)\
-	size += (bump);\
-	if (((target) = realloc((target), size * sizeof(*target))) == NULL) {\
+	(target) = arena_realloc(_this->arena, (target), size * sizeof(*(target)), (size + MAX(size, (size_t) (bump))) * sizeof(*(target)));\
+	size += MAX(size, (size_t) (bump));\
+	if ((target) == NULL) {\
 		ERROR(ENOMEM, "Unable to resize " #target " to size %d", size);\
 		return NULL;\
 	}
 
-LINKAGE_PRIVATE Args parse_args(Parser* _this, Lexer* lexer, size_t* count) {
+// Materialise the current token slice, the single copy made of each string in the line
+LINKAGE_PRIVATE char* current_string(Parser* _this, Lexer* lexer) {
+	TokenSlice slice = lexer_current_slice(lexer);
+	return arena_strndup(_this->arena, lexer_slice_start(lexer, &slice), slice.length);
+}
+
+#define TIME_KEYWORD "time"
+#define FAN_OUT_OPEN "{"
+#define FAN_OUT_SEPARATOR ","
+#define FAN_OUT_CLOSE "}"
+
+// true: The current token is the unquoted word, a quoted or escaped one is an ordinary string
+LINKAGE_PRIVATE bool is_keyword(Lexer* lexer, const char* keyword) {
+	if (lexer_current_symbol(lexer) != STRING) {
+		return false;
+	}
+	TokenSlice slice = lexer_current_slice(lexer);
+	return slice.flags == 0 && slice.length == strlen(keyword)
+		&& strncmp(lexer_slice_start(lexer, &slice), keyword, slice.length) == 0;
+}
+
+LINKAGE_PRIVATE bool ends_branch(Lexer* lexer) {
+	return is_keyword(lexer, FAN_OUT_SEPARATOR) || is_keyword(lexer, FAN_OUT_CLOSE);
+}
+
+// true: An unquoted word fused with a { , } keyword ({a, a, a}), rejected within a fan-out rather than read as an argument
+LINKAGE_PRIVATE bool is_fused_keyword(Lexer* lexer) {
+	if (lexer_current_symbol(lexer) != STRING) {
+		return false;
+	}
+	TokenSlice slice = lexer_current_slice(lexer);
+	const char* word = lexer_slice_start(lexer, &slice);
+	return slice.flags == 0 && slice.length > 1 && (
+		strncmp(word, FAN_OUT_OPEN, 1) == 0
+		|| strncmp(&word[slice.length - 1], FAN_OUT_SEPARATOR, 1) == 0
+		|| strncmp(&word[slice.length - 1], FAN_OUT_CLOSE, 1) == 0
+	);
+}
+
+#define FUSED_KEYWORD_ERROR "Fan-out " FAN_OUT_OPEN " " FAN_OUT_SEPARATOR " " FAN_OUT_CLOSE " must be separate words"
+
+LINKAGE_PRIVATE PipeList parse_pipe_list(Parser* _this, Lexer* lexer, size_t* count);
+
+// -1: Failure, 0: Appended the <(...) or >(...) starting at the current token, which is left on its )
+LINKAGE_PRIVATE int parse_substitution(Parser* _this, Lexer* lexer, size_t argIndex, Substitution** substitutions, size_t* count) {
+	bool output = lexer_current_symbol(lexer) == PROCESS_OUT;
+	if (!lexer_next_symbol(lexer)) {
+		ERROR(EINVAL, "Unable to parse process substitution command");
+		return -1;
+	}
+	size_t pipeCount;
+	PipeList pipes = parse_pipe_list(_this, lexer, &pipeCount);
+	if (pipes == NULL) {
+		return -1;
+	} else if (lexer_current_symbol(lexer) != CLOSE_PAREN) {
+		ERROR(EINVAL, "Expected %s closing process substitution, got %s", token_names[CLOSE_PAREN], token_names[lexer_current_symbol(lexer)]);
+		return -1;
+	}
+	// Capacity is the count rounded up to a power of two, so it doubles when the count reaches one
+	if ((*count & (*count - 1)) == 0) {
+		size_t capacity = *count == 0 ? 1 : *count * 2;
+		Substitution* grown = arena_realloc(_this->arena, *substitutions, *count * sizeof(**substitutions), capacity * sizeof(**substitutions));
+		if (grown == NULL) {
+			ERROR(ENOMEM, "Unable to resize substitutions to size %zu", capacity);
+			return -1;
+		}
+		*substitutions = grown;
+	}
+	(*substitutions)[(*count)++] = (Substitution) { argIndex, output, pipeCount, pipes };
+	return 0;
+}
+
+// branch: Within a fan-out, where the arguments end at its , and } words
+LINKAGE_PRIVATE Args parse_args(Parser* _this, Lexer* lexer, size_t* count, bool branch, Substitution** substitutions, size_t* substitutionCount) {
 	INSTANCE_NULL_CHECK_RETURN("parser", _this, NULL);	
 	if (lexer_current_symbol(lexer) != STRING) {
 		*count = 0;
@@ -59,20 +152,37 @@ LINKAGE_PRIVATE Args parse_args(Parser* _this, Lexer* lexer, size_t* count) {
 		return NULL;
 	}
 	size_t size = _this->arg_list_base_size;
-	Args args = calloc(size, sizeof(*args));
+	Args args = arena_calloc(_this->arena, size, sizeof(*args));
 	verrno_return(args, NULL, "Unable to allocate Args of size %d", size);
 	Token symbol;
 	size_t index = 1;
+	*substitutions = NULL;
+	*substitutionCount = 0;
 	 while (lexer_next_symbol(lexer)) {	
 		symbol = lexer_current_symbol(lexer);
-		if (symbol != STRING) {
+		bool substituted = symbol == PROCESS_IN || symbol == PROCESS_OUT;
+		if (!substituted && (symbol != STRING || (branch && ends_branch(lexer)))) {
 			break;
+		} else if (branch && is_fused_keyword(lexer)) {
+			ERROR(EINVAL, FUSED_KEYWORD_ERROR);
+			return NULL;
 		} else if (index >= size - 1) {
 			// Resize the Args if we have more than the space allocated currently allows for
 			HANDLED_REALLOC(args, _this->arg_list_base_size);
 		}
+		if (substituted) {
+			if (parse_substitution(_this, lexer, index, substitutions, substitutionCount)) {
+				return NULL;
+			}
+			// Replaced by the /dev/fd path when run, kept as written for descriptions
+			verrno_return(
+				args[index++] = arena_strndup(_this->arena, symbol == PROCESS_IN ? "<(" : ">(", 2),
+				NULL, "Unable to duplicate argument string"
+			);
+			continue;
+		}
 		verrno_return(
-			args[index++] = strdup(lexer_current_string(lexer)),
+			args[index++] = current_string(_this, lexer),
 			NULL, "Unable to duplicate argument string"
 		);
 	}
@@ -85,7 +195,7 @@ LINKAGE_PRIVATE Args parse_args(Parser* _this, Lexer* lexer, size_t* count) {
 }
 
 // -1: Failure, 0: Continue, 1: Terminate
-LINKAGE_PRIVATE int parse_command_and_args(Parser* _this, Lexer* lexer, Command** commandAndArgs) {
+LINKAGE_PRIVATE int parse_command_and_args(Parser* _this, Lexer* lexer, Command** commandAndArgs, bool branch) {
 	INSTANCE_NULL_CHECK_RETURN("parser", _this, -1);
 	Token prefix = lexer_current_symbol(lexer);
 	char* command;
@@ -95,30 +205,48 @@ LINKAGE_PRIVATE int parse_command_and_args(Parser* _this, Lexer* lexer, Command*
 	} else if (prefix == PIPE && !lexer_next_symbol(lexer)) {
 		ERROR(EINVAL, "Unable to parse command following pipe");
 		return -1;
-	} else if ((command = strdup(lexer_current_string(lexer))) == NULL) {
+	} else if (lexer_current_symbol(lexer) != STRING) {
+		ERROR(EINVAL, "Expected a subcommand, got %s", token_names[lexer_current_symbol(lexer)]);
+		return -1;
+	} else if (branch && is_fused_keyword(lexer)) {
+		ERROR(EINVAL, FUSED_KEYWORD_ERROR);
+		return -1;
+	} else if ((command = current_string(_this, lexer)) == NULL) {
 		ERROR(ENOMEM, "unable to duplicate command string");
 		return -1;
 	}
 	size_t argCount;
-	Args args = parse_args(_this, lexer, &argCount);
-	args[0] = strdup(command);
+	Substitution* substitutions;
+	size_t substitutionCount;
+	Args args = parse_args(_this, lexer, &argCount, branch, &substitutions, &substitutionCount);
+	if (args == NULL) {
+		return -1;
+	}
+	// Both reference the same immutable arena string
+	args[0] = command;
 	*commandAndArgs = command_new(
+		_this->arena,
 		command,
 		args,
-		argCount
+		argCount,
+		substitutions,
+		substitutionCount
 	);
+	if (*commandAndArgs == NULL) {
+		return -1;
+	}
 	return lexer_current_symbol(lexer) != PIPE;
 } 
 
 LINKAGE_PRIVATE PipeList parse_pipe_list(Parser* _this, Lexer* lexer, size_t* count) {
 	INSTANCE_NULL_CHECK_RETURN("parser", _this, NULL);
 	size_t size = _this->pipes_list_base_size;
-	PipeList pipes = calloc(size, sizeof(*pipes));
+	PipeList pipes = arena_calloc(_this->arena, size, sizeof(*pipes));
 	verrno_return(pipes, NULL, "Unable to allocate PipeList of size %d", size);
 	size_t index = 0;
 	do {
 		Command* commandAndArgs;
-		int res = parse_command_and_args(_this, lexer, &commandAndArgs);
+		int res = parse_command_and_args(_this, lexer, &commandAndArgs, false);
 		if (res == -1) {
 			return NULL;
 		} else if (index >= size - 1) {
@@ -134,13 +262,52 @@ LINKAGE_PRIVATE PipeList parse_pipe_list(Parser* _this, Lexer* lexer, size_t* co
 	return pipes;
 }
 
+// Commands of the { , } list following <FAN_OUT>, which is the current token
+LINKAGE_PRIVATE PipeList parse_fan_out(Parser* _this, Lexer* lexer, size_t* count) {
+	INSTANCE_NULL_CHECK_RETURN("parser", _this, NULL);
+	if (!lexer_next_symbol(lexer)) {
+		ERROR(EINVAL, "Expected " FAN_OUT_OPEN " following %s", token_names[FAN_OUT]);
+		return NULL;
+	} else if (is_fused_keyword(lexer)) {
+		ERROR(EINVAL, FUSED_KEYWORD_ERROR);
+		return NULL;
+	} else if (!is_keyword(lexer, FAN_OUT_OPEN)) {
+		ERROR(EINVAL, "Expected " FAN_OUT_OPEN " following %s", token_names[FAN_OUT]);
+		return NULL;
+	}
+	size_t size = _this->pipes_list_base_size;
+	PipeList branches = arena_calloc(_this->arena, size, sizeof(*branches));
+	verrno_return(branches, NULL, "Unable to allocate fan-out branches of size %d", size);
+	size_t index = 0;
+	do {
+		Command* commandAndArgs;
+		if (!lexer_next_symbol(lexer) || ends_branch(lexer)) {
+			ERROR(EINVAL, "Expected a fan-out branch command");
+			return NULL;
+		} else if (parse_command_and_args(_this, lexer, &commandAndArgs, true) == -1) {
+			return NULL;
+		} else if (index >= size - 1) {
+			HANDLED_REALLOC(branches, _this->pipes_list_base_size);
+		}
+		branches[index++] = commandAndArgs;
+		if (!ends_branch(lexer)) {
+			ERROR(EINVAL, "Expected " FAN_OUT_SEPARATOR " or " FAN_OUT_CLOSE " following a fan-out branch, got %s", token_names[lexer_current_symbol(lexer)]);
+			return NULL;
+		}
+	} while (!is_keyword(lexer, FAN_OUT_CLOSE));
+	// Past the }, to whatever follows the line's pipeline
+	lexer_next_symbol(lexer);
+	*count = index;
+	return branches;
+}
+
 // Generified modifier handling
 #define CASE_MODIFIER(_symbol, field, name)\
 	case _symbol:\
 		if ((field) != NULL) {\
 			ERROR(EINVAL, "Multiple " name " redirection is not supported");\
 			return NULL;\
-		} else if (((field) = strdup(lexer_current_string(lexer))) == NULL) {\
+		} else if (((field) = current_string(_this, lexer)) == NULL) {\
 			ERROR(ENOMEM, "Unable to duplicate modifier target string");\
 			return NULL;\
 		}\
@@ -148,7 +315,7 @@ LINKAGE_PRIVATE PipeList parse_pipe_list(Parser* _this, Lexer* lexer, size_t* co
 
 LINKAGE_PRIVATE IoModifiers* parse_io_modifiers(Parser* _this, Lexer* lexer) {
 	INSTANCE_NULL_CHECK_RETURN("parser", _this, NULL);
-	IoModifiers* ioModifiers = io_modifiers_new(NULL);
+	IoModifiers* ioModifiers = io_modifiers_new(_this->arena, NULL);
 	verrno_return(ioModifiers, NULL, "Unable to allocate IoModifiers");
 	Token symbol;
 	size_t index = 0;
@@ -181,33 +348,66 @@ LINKAGE_PRIVATE BackgroundOp parse_background_op(Parser* _this, Lexer* lexer) {
 	return token == AMPERSAND;
 }
 
+// true: The line is prefixed with the time keyword, which is consumed
+LINKAGE_PRIVATE bool parse_timed(Parser* _this, Lexer* lexer) {
+	if (!is_keyword(lexer, TIME_KEYWORD)) {
+		return false;
+	}
+	lexer_next_symbol(lexer);
+	return true;
+}
+
 LINKAGE_PRIVATE CommandLine* parse_command_line(Parser* _this, Lexer* lexer) {
 	INSTANCE_NULL_CHECK_RETURN("parser", _this, 0);
+	bool timed = parse_timed(_this, lexer);
 	size_t pipeCount = 0;
-	PipeList pipes = parse_pipe_list(_this, lexer, &pipeCount);
+	PipeList pipes;
+	if (timed && (lexer_current_symbol(lexer) == EOI || lexer_current_symbol(lexer) == AMPERSAND)) {
+		// Timing nothing, as in a bare time
+		pipes = arena_calloc(_this->arena, 1, sizeof(*pipes));
+	} else {
+		pipes = parse_pipe_list(_this, lexer, &pipeCount);
+	}
 	if (pipes == NULL) {
 		return NULL;
 	}
+	size_t branchCount = 0;
+	PipeList branches = NULL;
+	if (lexer_current_symbol(lexer) == FAN_OUT) {
+		if ((branches = parse_fan_out(_this, lexer, &branchCount)) == NULL) {
+			return NULL;
+		}
+		// The branches end the pipeline, only the line's redirection and & may follow them
+		Token symbol = lexer_current_symbol(lexer);
+		if (!is_modifier(symbol) && symbol != AMPERSAND && symbol != EOI) {
+			ERROR(EINVAL, "Unexpected %s following " FAN_OUT_CLOSE, token_names[symbol]);
+			return NULL;
+		}
+	}
 	IoModifiers* ioModifiers = parse_io_modifiers(_this, lexer);
 	if (ioModifiers == NULL) {
 		return NULL;
 	}
 	BackgroundOp bgOp = parse_background_op(_this, lexer);
 	return command_line_new(
+		_this->arena,
 		pipes,
 		pipeCount,
+		branches,
+		branchCount,
 		ioModifiers,
-		bgOp
+		bgOp,
+		timed
 	);
 }
 
 LINKAGE_PUBLIC CommandTable* parse(Parser* _this, Lexer* lexer) {
 	INSTANCE_NULL_CHECK_RETURN("parser", _this, NULL);
-	CommandTable* table = command_table_new();
+	CommandTable* table = command_table_new(_this->arena);
 	verrno_return(table, NULL, "Unable to allocate CommandTable");
 	size_t size = _this->command_list_base_size;
-	table->lines = calloc(size, sizeof(*(table->lines)));
-	verrno_return(table, NULL, "Unable to allocate command list of size %d", size);
+	table->lines = arena_calloc(_this->arena, size, sizeof(*(table->lines)));
+	verrno_return(table->lines, NULL, "Unable to allocate command list of size %d", size);
 	size_t index = 0;
 	Token symbol;
 	while (lexer_next_symbol(lexer) && (symbol = lexer_current_symbol(lexer)) != EOI) {
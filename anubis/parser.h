@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 
+#include "arena.h"
 #include "lexer.h"
 #include "structure.h"
 
@@ -11,19 +12,25 @@
 #define DEFAULT_COMMAND_LIST_SIZE 5
 
 typedef struct Parser {
+	Arena* arena;
 	size_t arg_list_base_size;
 	size_t pipes_list_base_size;
 	size_t command_list_base_size;
 } Parser;
 
-Parser parser_default();
+// Every structure produced by parse(...) is owned by the given arena
+Parser parser_default(Arena* arena);
 
 /* PARSER TYPE: LR(1) [Left to right, Rightmost derivation, Single token lookahead]
  * PARSER GRAMMAR:
  * =================================================
  * GOAL: CommandList;
  *
- * Args: <STRING>*;
+ * Substitution:
+ *		| <PROCESS_IN> PipeList <CLOSE_PAREN>
+ *		| <PROCESS_OUT> PipeList <CLOSE_PAREN>;
+ *
+ * Args: (<STRING> | Substitution)*;
  *
  * Command: <STRING> Args;
  *
@@ -31,6 +38,12 @@ Parser parser_default();
  *		| <PIPE> Command PipeList
  *		| Command;
  *
+ * Branches:
+ *		| "," Command Branches
+ *		| "}";
+ *
+ * FanOut: (<FAN_OUT> "{" Command Branches)?; (unquoted { , } words, each branch's Args end at the next one)
+ *
  * IoModifier:
  *		| <GREATER> <STRING>;
  *
@@ -38,7 +51,9 @@ Parser parser_default();
  *
  * BackgroundOp: <AMPERSAND>?;
  *
- * CommandLine: PipeList IoModifiers BackgroundOp;
+ * Timed: "time"?; (an unquoted time word starting the line, the pipe list may then be empty)
+ *
+ * CommandLine: Timed PipeList FanOut IoModifiers BackgroundOp;
  *
  * CommandList: CommandLine*;
  * =================================================
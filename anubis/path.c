@@ -5,14 +5,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <dirent.h>
 
 #include "error.h"
 #include "checks.h"
 #include "mem_utils.h"
+#include "path_cache.h"
 #include "visibility.h"
 
 #define PATH_DELIMITER '/'
@@ -23,12 +25,17 @@ static char* initialPath = "/bin";
 char* path;
 static size_t pathLen;
 
+LINKAGE_PRIVATE void path_invalidate();
+
 LINKAGE_PUBLIC int path_init() {
 	path = calloc(INITIAL_PATH_LEN + 1, sizeof(*path));
 	INSTANCE_NULL_CHECK_RETURN("path", path, 1);
 	path[INITIAL_PATH_LEN] = '\0';
 	strncpy(path, initialPath, INITIAL_PATH_LEN);
 	pathLen = INITIAL_PATH_LEN;
+	int ret;
+	transparent_return(path_cache_init());
+	path_invalidate();
 	return 0;
 }
 
@@ -38,6 +45,7 @@ LINKAGE_PUBLIC void path_clear() {
 	}
 	memset(path, '\0', INITIAL_PATH_LEN);
 	pathLen = 0;
+	path_invalidate();
 }
 
 LINKAGE_PUBLIC int path_add(char** paths, size_t count) {
@@ -54,10 +62,12 @@ LINKAGE_PUBLIC int path_add(char** paths, size_t count) {
 		path[pathLen + newPathLen + offset] = '\0';
 		pathLen += newPathLen + offset;
 	}
+	path_invalidate();
 	return 0;
 }
 
 LINKAGE_PUBLIC void path_free() {
+	path_cache_free();
 	checked_free(path);
 }
 
@@ -77,40 +87,55 @@ LINKAGE_PRIVATE char* join_paths(const char* dir, const char* file) {
 	return newPath;
 }
 
-static char* filename = NULL;
-
-#define NON_EXEC_TARGET(entry) (\
-	(entry) != DT_REG\
-	&& (entry) != DT_LNK\
-	&& (entry) != DT_CHR\
-	&& (entry) != DT_UNKNOWN\
-	)
+LINKAGE_PRIVATE char* resolve_within_directory(char* searchable, char* dirPath) {
+	// Probe the single candidate directly rather than scanning the whole directory
+	char* candidate = join_paths(dirPath, searchable);
+	if (candidate == NULL) {
+		return NULL;
+	}
+	struct stat sstat;
+	if (stat(candidate, &sstat) == 0
+		&& (S_ISREG(sstat.st_mode) || S_ISCHR(sstat.st_mode))
+		&& access(candidate, X_OK) == 0) {
+		return candidate;
+	}
+	free(candidate);
+	return NULL;
+}
 
-LINKAGE_PRIVATE int directory_filter(const struct dirent* dir) {
-	if (!dir || NON_EXEC_TARGET(dir->d_type) || strcmp(dir->d_name, filename)) {
-		return 0;
+// 0: No more entries, Otherwise: length of the entry copied into buffer
+LINKAGE_PRIVATE size_t next_path_entry(const char** cursor, char* buffer, size_t size) {
+	while (**cursor == PATH_ENV_DELIMITER[0]) {
+		(*cursor)++;
 	}
-	if (dir->d_type == DT_LNK || dir->d_type == DT_UNKNOWN) {
-		struct stat sstat;
-		return stat(filename, &sstat) && (S_ISREG(sstat.st_mode) || S_ISCHR(sstat.st_mode));
+	size_t len = strcspn(*cursor, PATH_ENV_DELIMITER);
+	const char* end = *cursor + len;
+	if (len >= size) {
+		// Longer than any resolvable directory, skip it entirely
+		*cursor = end;
+		return next_path_entry(cursor, buffer, size);
 	}
-	return 1;
+	memcpy(buffer, *cursor, len);
+	buffer[len] = '\0';
+	*cursor = end;
+	return len;
 }
 
-LINKAGE_PRIVATE char* resolve_within_directory(char* searchable, char* dirPath) {
-	struct dirent** dirEntries;
-	filename = searchable;
-	int n = scandir(dirPath, &dirEntries, directory_filter, alphasort);
-	filename = NULL;
-	bool found = n > 0;
-	if (found) {
-		checked_array_free(dirEntries, n, free);
-	}
-	free(dirEntries);
-	if (!found) {
-		return NULL;
+LINKAGE_PRIVATE void path_watch_all() {
+	path_cache_unwatch_all();
+	if (path == NULL) {
+		return;
 	}
-	return join_paths(dirPath, searchable);
+	char searchable[PATH_MAX];
+	const char* cursor = path;
+	while (next_path_entry(&cursor, searchable, sizeof(searchable)) > 0) {
+		path_cache_watch(searchable);
+	}
+}
+
+LINKAGE_PRIVATE void path_invalidate() {
+	path_cache_flush();
+	path_watch_all();
 }
 
 LINKAGE_PRIVATE bool is_path(char* searchable) {
@@ -136,32 +161,94 @@ LINKAGE_PRIVATE bool is_path(char* searchable) {
 	return true;
 }
 
-LINKAGE_PUBLIC char* path_resolve(char* executable) {
-	if (is_path(executable)) {
-		return strdup(executable);
-	}
-	char* searchable = strtok(path, PATH_ENV_DELIMITER);
-	while (searchable != NULL) {
+LINKAGE_PRIVATE char* path_search(char* executable) {
+	char searchable[PATH_MAX];
+	const char* cursor = path;
+	while (next_path_entry(&cursor, searchable, sizeof(searchable)) > 0) {
 		struct stat	sstat;
 		if (stat(searchable, &sstat) != 0) {
 			// Skip if we can't resolve the path
-			goto next;
+			continue;
 		} else if (S_ISDIR(sstat.st_mode)) {
 			char* resolved = resolve_within_directory(executable, searchable);
-			if (resolved != NULL && access(resolved, F_OK | X_OK) == 0) {
+			if (resolved != NULL) {
 				// Directory has an entry that matches the given executable name
 				return resolved;
 			}
-			goto next;
+			continue;
 		}
 		char* slash = strrchr(searchable, PATH_DELIMITER);
-		if (slash && strcmp(slash, searchable) && access(searchable, F_OK | X_OK) == 0) {
+		if (slash && strcmp(slash + 1, executable) == 0 && access(searchable, F_OK | X_OK) == 0) {
 			// File name at searchable path matches given executable name
-			return searchable;
+			return strdup(searchable);
 		}
-next:
-		// Tokenise from previously found offset
-		searchable = strtok(NULL, PATH_ENV_DELIMITER);
 	}
 	return NULL;
 }
+
+LINKAGE_PUBLIC void path_rewatch() {
+	path_watch_all();
+}
+
+LINKAGE_PRIVATE void prime_directory(char* dirPath) {
+	DIR* dir = opendir(dirPath);
+	if (dir == NULL) {
+		return;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		// Earlier directories take precedence, as in path_search
+		if (entry->d_name[0] == '.' || path_cache_lookup(entry->d_name) != NULL) {
+			continue;
+		}
+		char* resolved = resolve_within_directory(entry->d_name, dirPath);
+		if (resolved != NULL) {
+			path_cache_insert(entry->d_name, resolved, 0);
+			free(resolved);
+		}
+	}
+	closedir(dir);
+}
+
+LINKAGE_PUBLIC void path_prime() {
+	if (path_cache_stale()) {
+		path_invalidate();
+	}
+	char searchable[PATH_MAX];
+	const char* cursor = path;
+	while (next_path_entry(&cursor, searchable, sizeof(searchable)) > 0) {
+		prime_directory(searchable);
+	}
+}
+
+LINKAGE_PUBLIC char* path_resolve(char* executable) {
+	if (is_path(executable)) {
+		return strdup(executable);
+	} else if (path_cache_stale()) {
+		path_invalidate();
+	}
+	const char* cached = path_cache_lookup(executable);
+	if (cached != NULL) {
+		return strdup(cached);
+	}
+	char* resolved = path_search(executable);
+	if (resolved != NULL) {
+		path_cache_insert(executable, resolved, 1);
+	}
+	return resolved;
+}
+
+LINKAGE_PUBLIC int path_rehash(char* executable) {
+	if (is_path(executable)) {
+		return EINVAL;
+	} else if (path_cache_stale()) {
+		path_invalidate();
+	}
+	char* resolved = path_search(executable);
+	if (resolved == NULL) {
+		return ENOENT;
+	}
+	int ret = path_cache_insert(executable, resolved, 0);
+	free(resolved);
+	return ret;
+}
@@ -13,5 +13,11 @@ int path_add(char** paths, size_t count);
 void path_free();
 
 char* path_resolve(char* executable);
+// Cache every executable on the path up front, for processes forked to serve commands
+void path_prime();
+// Watch the path on a fresh instance, a forked process must not consume its parent's changes
+void path_rewatch();
+// Resolve bypassing the cache and record the result with no hits
+int path_rehash(char* executable);
 
 #endif // ANUBIS_PATH_H
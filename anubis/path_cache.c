@@ -0,0 +1,217 @@
+#include "path_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "error.h"
+#include "checks.h"
+#include "mem_utils.h"
+#include "hash_utils.h"
+#include "visibility.h"
+
+// Grow once the table is 3/4 full to keep probe sequences short
+#define LOAD_FACTOR_EXCEEDED(count, capacity) ((count) * 4 >= (capacity) * 3)
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define INOTIFY_BUFFER_SIZE 4096
+
+/* Fallback for kernels without inotify, the modification time of each
+ * search directory is compared on every staleness check instead.
+ */
+typedef struct DirectoryStamp {
+	char* dir;
+	struct timespec mtime;
+	bool present;
+} DirectoryStamp;
+
+static PathCacheEntry* entries = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+
+static int inotifyFd = -1;
+static bool inotifyUnavailable = false;
+static DirectoryStamp* stamps = NULL;
+static size_t stampCount = 0;
+
+LINKAGE_PRIVATE size_t hash_name(const char* name) {
+	uint64_t hash = FNV_OFFSET_BASIS;
+	for (const unsigned char* c = (const unsigned char*) name; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= FNV_PRIME;
+	}
+	return (size_t) hash;
+}
+
+LINKAGE_PRIVATE PathCacheEntry* find_slot(PathCacheEntry* table, size_t size, const char* name, size_t hash) {
+	size_t mask = size - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		PathCacheEntry* entry = &table[i];
+		if (entry->name == NULL || (entry->hash == hash && strcmp(entry->name, name) == 0)) {
+			return entry;
+		}
+	}
+}
+
+LINKAGE_PRIVATE int grow() {
+	size_t newCapacity = capacity * 2;
+	PathCacheEntry* newEntries = calloc(newCapacity, sizeof(*newEntries));
+	INSTANCE_NULL_CHECK_RETURN("path cache", newEntries, ENOMEM);
+	for (size_t i = 0; i < capacity; i++) {
+		if (entries[i].name != NULL) {
+			*find_slot(newEntries, newCapacity, entries[i].name, entries[i].hash) = entries[i];
+		}
+	}
+	free(entries);
+	entries = newEntries;
+	capacity = newCapacity;
+	return 0;
+}
+
+LINKAGE_PUBLIC int path_cache_init() {
+	entries = calloc(PATH_CACHE_INITIAL_CAPACITY, sizeof(*entries));
+	INSTANCE_NULL_CHECK_RETURN("path cache", entries, 1);
+	capacity = PATH_CACHE_INITIAL_CAPACITY;
+	count = 0;
+	return 0;
+}
+
+LINKAGE_PUBLIC void path_cache_flush() {
+	for (size_t i = 0; i < capacity; i++) {
+		checked_free(entries[i].name);
+		checked_free(entries[i].resolved);
+		entries[i] = (PathCacheEntry) { 0 };
+	}
+	count = 0;
+}
+
+LINKAGE_PUBLIC size_t path_cache_size() {
+	return count;
+}
+
+LINKAGE_PUBLIC void path_cache_free() {
+	if (entries == NULL) {
+		// Invoked in shutdown hook, ignore if never initialised
+		return;
+	}
+	path_cache_flush();
+	path_cache_unwatch_all();
+	free(entries);
+	entries = NULL;
+	capacity = 0;
+}
+
+LINKAGE_PUBLIC const char* path_cache_lookup(const char* name) {
+	if (entries == NULL) {
+		return NULL;
+	}
+	PathCacheEntry* entry = find_slot(entries, capacity, name, hash_name(name));
+	if (entry->name == NULL) {
+		return NULL;
+	}
+	entry->hits++;
+	return entry->resolved;
+}
+
+LINKAGE_PUBLIC int path_cache_insert(const char* name, const char* resolved, size_t hits) {
+	INSTANCE_NULL_CHECK_RETURN("path cache", entries, EINVAL);
+	int ret;
+	if (LOAD_FACTOR_EXCEEDED(count + 1, capacity)) {
+		transparent_return(grow());
+	}
+	size_t hash = hash_name(name);
+	PathCacheEntry* entry = find_slot(entries, capacity, name, hash);
+	char* resolvedCopy = strdup(resolved);
+	INSTANCE_NULL_CHECK_RETURN("resolved path", resolvedCopy, ENOMEM);
+	if (entry->name != NULL) {
+		// Re-resolved, replace the stale target but keep the existing key
+		free(entry->resolved);
+		entry->resolved = resolvedCopy;
+		entry->hits = hits;
+		return 0;
+	}
+	if ((entry->name = strdup(name)) == NULL) {
+		free(resolvedCopy);
+		ERROR(ENOMEM, "Unable to duplicate executable name");
+		return ENOMEM;
+	}
+	entry->hash = hash;
+	entry->hits = hits;
+	entry->resolved = resolvedCopy;
+	count++;
+	return 0;
+}
+
+LINKAGE_PUBLIC void path_cache_foreach(PathCacheVisitor visitor) {
+	for (size_t i = 0; i < capacity; i++) {
+		if (entries[i].name != NULL) {
+			visitor(&entries[i]);
+		}
+	}
+}
+
+LINKAGE_PRIVATE int stamp_directory(DirectoryStamp* stamp) {
+	struct stat sstat;
+	stamp->present = stat(stamp->dir, &sstat) == 0;
+	stamp->mtime = stamp->present ? sstat.st_mtim : (struct timespec) { 0 };
+	return 0;
+}
+
+LINKAGE_PUBLIC int path_cache_watch(const char* dir) {
+	if (inotifyFd == -1 && !inotifyUnavailable) {
+		if ((inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+			inotifyUnavailable = true;
+		}
+	}
+	if (inotifyFd != -1) {
+		// Missing directories are skipped during resolution anyway, so failing to watch one is benign
+		inotify_add_watch(inotifyFd, dir, WATCH_MASK);
+		return 0;
+	}
+	DirectoryStamp* newStamps = realloc(stamps, (stampCount + 1) * sizeof(*stamps));
+	INSTANCE_NULL_CHECK_RETURN("directory stamps", newStamps, ENOMEM);
+	stamps = newStamps;
+	DirectoryStamp* stamp = &stamps[stampCount];
+	stamp->dir = strdup(dir);
+	INSTANCE_NULL_CHECK_RETURN("directory name", stamp->dir, ENOMEM);
+	stampCount++;
+	return stamp_directory(stamp);
+}
+
+LINKAGE_PUBLIC void path_cache_unwatch_all() {
+	if (inotifyFd != -1) {
+		// Closing the instance drops every watch in one go
+		close(inotifyFd);
+		inotifyFd = -1;
+	}
+	for (size_t i = 0; i < stampCount; i++) {
+		free(stamps[i].dir);
+	}
+	checked_free(stamps);
+	stamps = NULL;
+	stampCount = 0;
+}
+
+LINKAGE_PUBLIC bool path_cache_stale() {
+	if (inotifyFd != -1) {
+		char buffer[INOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+		bool changed = false;
+		while (read(inotifyFd, buffer, sizeof(buffer)) > 0) {
+			changed = true;
+		}
+		return changed;
+	}
+	bool changed = false;
+	for (size_t i = 0; i < stampCount; i++) {
+		DirectoryStamp previous = stamps[i];
+		stamp_directory(&stamps[i]);
+		changed |= previous.present != stamps[i].present
+			|| previous.mtime.tv_sec != stamps[i].mtime.tv_sec
+			|| previous.mtime.tv_nsec != stamps[i].mtime.tv_nsec;
+	}
+	return changed;
+}
@@ -0,0 +1,34 @@
+#ifndef ANUBIS_PATH_CACHE_H
+#define ANUBIS_PATH_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PATH_CACHE_INITIAL_CAPACITY 64
+
+typedef struct PathCacheEntry {
+	size_t hash;
+	size_t hits;
+	char* name;
+	char* resolved;
+} PathCacheEntry;
+
+int path_cache_init();
+void path_cache_free();
+
+// NULL: Not cached, Otherwise: resolved path owned by the cache
+const char* path_cache_lookup(const char* name);
+int path_cache_insert(const char* name, const char* resolved, size_t hits);
+void path_cache_flush();
+size_t path_cache_size();
+
+// Register a search directory whose modification invalidates the cache
+int path_cache_watch(const char* dir);
+void path_cache_unwatch_all();
+// true: A watched directory changed since the last check (pending changes are consumed)
+bool path_cache_stale();
+
+typedef void (*PathCacheVisitor)(const PathCacheEntry*);
+void path_cache_foreach(PathCacheVisitor visitor);
+
+#endif // ANUBIS_PATH_CACHE_H
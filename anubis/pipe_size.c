@@ -0,0 +1,56 @@
+#define _GNU_SOURCE
+
+#include "pipe_size.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+
+#include "options.h"
+#include "visibility.h"
+
+#define PIPE_MAX_SIZE_FILE "/proc/sys/fs/pipe-max-size"
+// Kernel default when the limit can't be read
+#define PIPE_DEFAULT_MAX_SIZE (1 << 20)
+#define FAIL_COND -1
+
+LINKAGE_PUBLIC size_t pipe_size_max() {
+	static size_t max = 0;
+	if (max != 0) {
+		return max;
+	}
+	max = PIPE_DEFAULT_MAX_SIZE;
+	FILE* file = fopen(PIPE_MAX_SIZE_FILE, "re");
+	if (file != NULL) {
+		size_t value;
+		if (fscanf(file, "%zu", &value) == 1 && value > 0) {
+			max = value;
+		}
+		fclose(file);
+	}
+	return max;
+}
+
+LINKAGE_TRANSPARENT size_t clamp_size(size_t size) {
+	size_t max = pipe_size_max();
+	return size > max ? max : size;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC void pipe_size_apply(int fd) {
+	if (options.pipeSizing == PIPE_SIZING_FIXED) {
+		// Best effort, the per-user pipe page quota may refuse it
+		fcntl(fd, F_SETPIPE_SZ, (int) clamp_size(options.pipeSize));
+	}
+}
+
+LINKAGE_PUBLIC size_t pipe_size_grow(int fd) {
+	if (options.pipeSizing != PIPE_SIZING_ADAPTIVE) {
+		return 0;
+	}
+	int current = fcntl(fd, F_GETPIPE_SZ);
+	if (current == FAIL_COND || (size_t) current >= pipe_size_max()) {
+		return 0;
+	}
+	int grown = fcntl(fd, F_SETPIPE_SZ, (int) clamp_size((size_t) current * 2));
+	return grown == FAIL_COND || grown <= current ? 0 : (size_t) grown;
+}
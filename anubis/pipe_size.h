@@ -0,0 +1,19 @@
+#ifndef ANUBIS_PIPE_SIZE_H
+#define ANUBIS_PIPE_SIZE_H
+
+#include <stddef.h>
+
+/* Pipe buffer sizing policy (see options.pipeSizing). Fixed sizes are applied
+ * to every pipe the executor creates, adaptive sizing starts from the kernel
+ * default and doubles a pipe each time a relay finds it full. Both are bounded
+ * by /proc/sys/fs/pipe-max-size, and failures leave the pipe as it was.
+ */
+
+// Upper bound of F_SETPIPE_SZ for unprivileged processes
+size_t pipe_size_max();
+// Apply the configured fixed size to a newly created pipe
+void pipe_size_apply(int fd);
+// 0: Not grown (policy, at the limit or refused), Otherwise: the new capacity
+size_t pipe_size_grow(int fd);
+
+#endif // ANUBIS_PIPE_SIZE_H
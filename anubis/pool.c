@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "jobs.h"
+#include "relay.h"
+#include "spawn.h"
+#include "line_reader.h"
+#include "visibility.h"
+
+#define FAIL_COND -1
+
+typedef struct Instance {
+	// Each instance is a job of its own, listed by jobs while it runs
+	int jobId;
+	// Captured stdout and stderr, -1 once written out
+	int out;
+	int err;
+	bool done;
+} Instance;
+
+typedef struct Pool {
+	PoolTemplate* template;
+	// Given to every instance, the pool's own input is not theirs to read
+	int in;
+	bool substitute;
+	// Instances not yet written out, in input order from head
+	Instance* ring;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	size_t running;
+	// No children remain, whatever the jobs say
+	bool orphaned;
+	// An instance exited with a non-zero status or was killed
+	bool failed;
+} Pool;
+
+LINKAGE_PRIVATE bool has_placeholder(char** args) {
+	for (size_t i = 1; args[i] != NULL; i++) {
+		if (strstr(args[i], POOL_PLACEHOLDER) != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Heap allocated copy of arg with every placeholder replaced by input
+LINKAGE_PRIVATE char* substitute(const char* arg, const char* input) {
+	size_t placeholders = 0;
+	for (const char* at = arg; (at = strstr(at, POOL_PLACEHOLDER)) != NULL; at += strlen(POOL_PLACEHOLDER)) {
+		placeholders++;
+	}
+	size_t inputLength = strlen(input);
+	char* result = malloc(strlen(arg) + placeholders * inputLength + 1);
+	if (result == NULL) {
+		return NULL;
+	}
+	char* out = result;
+	for (const char* at = arg;;) {
+		const char* next = strstr(at, POOL_PLACEHOLDER);
+		if (next == NULL) {
+			strcpy(out, at);
+			break;
+		}
+		out = mempcpy(mempcpy(out, at, next - at), input, inputLength);
+		at = next + strlen(POOL_PLACEHOLDER);
+	}
+	return result;
+}
+
+LINKAGE_PRIVATE void free_args(char** args) {
+	for (size_t i = 0; args[i] != NULL; i++) {
+		free(args[i]);
+	}
+	free(args);
+}
+
+// NULL: Out of memory, Otherwise: NULL terminated arguments of the instance for input
+LINKAGE_PRIVATE char** instance_args(Pool* pool, const char* input) {
+	char** template = pool->template->args;
+	size_t count = 0;
+	while (template[count] != NULL) {
+		count++;
+	}
+	char** args = calloc(count + 2, sizeof(*args));
+	if (args == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if ((args[i] = i == 0 || !pool->substitute ? strdup(template[i]) : substitute(template[i], input)) == NULL) {
+			free_args(args);
+			return NULL;
+		}
+	}
+	if (!pool->substitute && (args[count] = strdup(input)) == NULL) {
+		free_args(args);
+		return NULL;
+	}
+	return args;
+}
+
+// Heap allocated description of the instance for its job, as the line would read
+LINKAGE_PRIVATE char* describe(char** args) {
+	size_t length = 0;
+	for (size_t i = 0; args[i] != NULL; i++) {
+		length += strlen(args[i]) + 1;
+	}
+	char* description = malloc(length + 1);
+	if (description == NULL) {
+		return NULL;
+	}
+	char* at = description;
+	for (size_t i = 0; args[i] != NULL; i++) {
+		at = stpcpy(at, args[i]);
+		*at++ = ' ';
+	}
+	at[at == description ? 0 : -1] = '\0';
+	return description;
+}
+
+LINKAGE_PRIVATE void write_out(Instance* instance) {
+	if (instance->out == FAIL_COND) {
+		return;
+	}
+	int err = relay_replay(instance->out, STDOUT_FILENO);
+	if (err == 0) {
+		err = relay_replay(instance->err, STDERR_FILENO);
+	}
+	if (err) {
+		ERROR(err, "Unable to write out parallel output");
+	}
+	close(instance->out);
+	close(instance->err);
+	instance->out = FAIL_COND;
+	instance->err = FAIL_COND;
+}
+
+// 0: The instance is running, Otherwise: errno (nothing was started)
+LINKAGE_PRIVATE int pool_start(Pool* pool, const char* input) {
+	char** args = instance_args(pool, input);
+	if (args == NULL) {
+		return ENOMEM;
+	}
+	int err = 0;
+	int out = memfd_create("anubis-parallel-stdout", MFD_CLOEXEC);
+	int errOut = out == FAIL_COND ? FAIL_COND : memfd_create("anubis-parallel-stderr", MFD_CLOEXEC);
+	if (errOut == FAIL_COND) {
+		err = errno;
+		if (out != FAIL_COND) {
+			close(out);
+		}
+		free_args(args);
+		return err;
+	}
+	IO io = { pool->in, out };
+	pid_t pid;
+	Job* job = NULL;
+	char* description = describe(args);
+	// The instance inherits stderr, as the commands of a line do
+	int savedErr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+	if (description == NULL) {
+		err = ENOMEM;
+	} else if ((job = job_new_described(description, false)) == NULL) {
+		free(description);
+		err = ENOMEM;
+	} else if (savedErr == FAIL_COND || dup2(errOut, STDERR_FILENO) == FAIL_COND) {
+		err = errno;
+	} else {
+		err = spawn_command(pool->template->resolved, args, &io, &pid);
+		dup2(savedErr, STDERR_FILENO);
+		if (err == 0) {
+			err = job_add_process(job, pid, 0);
+		}
+	}
+	if (savedErr != FAIL_COND) {
+		close(savedErr);
+	}
+	free_args(args);
+	if (err) {
+		if (job != NULL) {
+			job_remove(job);
+		}
+		close(out);
+		close(errOut);
+		return err;
+	}
+	pool->ring[(pool->head + pool->count) % pool->capacity] = (Instance) { job->id, out, errOut, false };
+	pool->count++;
+	pool->running++;
+	return 0;
+}
+
+// Waits for an instance to complete, writing out everything that can be
+LINKAGE_PRIVATE void pool_collect(Pool* pool) {
+	if (pool->running > 0 && !pool->orphaned && jobs_reap_next() == -1) {
+		pool->orphaned = true;
+	}
+	for (size_t i = 0; i < pool->count; i++) {
+		Instance* instance = &pool->ring[(pool->head + i) % pool->capacity];
+		Job* job = jobs_find(instance->jobId);
+		if (instance->done || (!pool->orphaned && job != NULL && job->state == JOB_RUNNING)) {
+			continue;
+		}
+		instance->done = true;
+		pool->running--;
+		if (job != NULL && job->state == JOB_DONE && !(WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0)) {
+			pool->failed = true;
+		}
+		// A stopped instance stays listed for fg, its output so far is all there is to write
+		if (job != NULL && job->state != JOB_STOPPED) {
+			job_remove(job);
+		}
+		if (!pool->template->keepOrder) {
+			write_out(instance);
+		}
+	}
+	while (pool->count > 0 && pool->ring[pool->head].done) {
+		write_out(&pool->ring[pool->head]);
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->count--;
+	}
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int pool_run(PoolTemplate* template, char** inputs, size_t inputCount, bool* failed) {
+	Pool pool = {
+		.template = template,
+		.in = STDIN_FILENO,
+		.substitute = has_placeholder(template->args),
+		.capacity = template->width * (template->keepOrder ? POOL_ORDER_WINDOW : 1)
+	};
+	LineReader reader = { 0 };
+	if ((pool.ring = calloc(pool.capacity, sizeof(*pool.ring))) == NULL) {
+		return ENOMEM;
+	} else if (inputs == NULL && ((pool.in = open("/dev/null", O_RDONLY | O_CLOEXEC)) == FAIL_COND
+		|| line_reader_init(&reader, STDIN_FILENO, LINE_READER_DEFAULT_CAPACITY))) {
+		int err = pool.in == FAIL_COND ? errno : ENOMEM;
+		if (pool.in != FAIL_COND) {
+			close(pool.in);
+		}
+		free(pool.ring);
+		return err;
+	}
+	// Whatever is already buffered would otherwise follow the instances' output
+	fflush(stdout);
+	int err = 0;
+	for (size_t i = 0; err == 0; i++) {
+		char* input;
+		if (inputs != NULL && i == inputCount) {
+			break;
+		} else if (inputs != NULL) {
+			input = inputs[i];
+		} else {
+			ssize_t count = line_reader_next(&reader, &input);
+			if (count <= 0) {
+				err = count < 0 ? errno : 0;
+				break;
+			}
+		}
+		while (pool.running == template->width || pool.count == pool.capacity) {
+			pool_collect(&pool);
+		}
+		err = pool_start(&pool, input);
+	}
+	while (pool.count > 0) {
+		pool_collect(&pool);
+	}
+	if (inputs == NULL) {
+		line_reader_free(&reader);
+		close(pool.in);
+	}
+	free(pool.ring);
+	*failed = pool.failed;
+	return err;
+}
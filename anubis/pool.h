@@ -0,0 +1,37 @@
+#ifndef ANUBIS_POOL_H
+#define ANUBIS_POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* One command run once per input on a pool of processes (the parallel
+ * builtin). Every {} in the template's arguments is replaced by the input, or
+ * without one the input is appended as the last argument. The executable is
+ * resolved once for every instance. Each instance's stdout and stderr are
+ * captured and written out whole once it completes, in input order when kept
+ * in order, so instances never interleave within their output.
+ */
+
+#define POOL_PLACEHOLDER "{}"
+// Separates the template from the inputs given as arguments
+#define POOL_INPUT_SEPARATOR ":::"
+// Completed instances held back for the one before them, per process, when kept in order
+#define POOL_ORDER_WINDOW 4
+
+typedef struct PoolTemplate {
+	char* resolved;
+	// args[0] is the command, NULL terminated
+	char** args;
+	// Processes running at once
+	size_t width;
+	bool keepOrder;
+} PoolTemplate;
+
+/* Runs the template over inputs, or the lines of stdin when inputs is NULL,
+ * failed is set if any instance exited non-zero or was killed.
+ * 0: Every instance ran, Otherwise: errno (instances already started are
+ * waited on and their output written out)
+ */
+int pool_run(PoolTemplate* template, char** inputs, size_t inputCount, bool* failed);
+
+#endif // ANUBIS_POOL_H
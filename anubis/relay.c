@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+
+#include "relay.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+#include "options.h"
+#include "pipe_size.h"
+#include "visibility.h"
+
+#define RELAY_BUFFER_SIZE 65536
+// Upper bound per call, splice and sendfile stop early at pipe capacity anyway
+#define RELAY_CHUNK_SIZE (1 << 20)
+#define FAIL_COND -1
+
+typedef enum RelayMode {
+	RELAY_MODE_COPY,
+	RELAY_MODE_SPLICE,
+	RELAY_MODE_SENDFILE
+} RelayMode;
+
+LINKAGE_PRIVATE RelayMode relay_mode(int in, int out) {
+	struct stat inStat;
+	struct stat outStat;
+	if (!options.zeroCopy || fstat(in, &inStat) || fstat(out, &outStat)) {
+		return RELAY_MODE_COPY;
+	} else if (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode)) {
+		return RELAY_MODE_SPLICE;
+	} else if (S_ISREG(inStat.st_mode)) {
+		return RELAY_MODE_SENDFILE;
+	}
+	return RELAY_MODE_COPY;
+}
+
+// Grow whichever pipe has a process blocked on it: a full input stalls the writer, a full output stalls us
+LINKAGE_PRIVATE void relay_adapt(int in, int out) {
+	int queued;
+	int capacity = fcntl(in, F_GETPIPE_SZ);
+	if (capacity != FAIL_COND && ioctl(in, FIONREAD, &queued) == 0 && queued >= capacity) {
+		pipe_size_grow(in);
+	}
+	struct pollfd writable = { .fd = out, .events = POLLOUT };
+	if (fcntl(out, F_GETPIPE_SZ) != FAIL_COND && poll(&writable, 1, 0) == 0) {
+		pipe_size_grow(out);
+	}
+}
+
+/* Pages are moved, never gifted: splice blocks once the output pipe is full,
+ * so at most one pipe buffer of data is in flight however fast the producer is.
+ * 0: Input exhausted, -1: Mode unsupported by these descriptors before any data
+ * moved, Otherwise: errno of the failed transfer
+ */
+__attribute__((hot))
+LINKAGE_PRIVATE int relay_zero_copy(int in, int out, RelayMode mode) {
+	bool moved = false;
+	bool adaptive = mode == RELAY_MODE_SPLICE && options.pipeSizing == PIPE_SIZING_ADAPTIVE;
+	for (;;) {
+		if (adaptive) {
+			relay_adapt(in, out);
+		}
+		ssize_t count = mode == RELAY_MODE_SPLICE
+			? splice(in, NULL, out, NULL, RELAY_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)
+			: sendfile(out, in, NULL, RELAY_CHUNK_SIZE);
+		if (count == 0) {
+			return 0;
+		} else if (count > 0) {
+			moved = true;
+			continue;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (!moved && (errno == EINVAL || errno == ENOSYS)) {
+			// e.g. a terminal or an O_APPEND file on the other end
+			return FAIL_COND;
+		}
+		return errno;
+	}
+}
+
+LINKAGE_PRIVATE int write_all(int fd, const char* data, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+		if (written == FAIL_COND) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno;
+		}
+		data += written;
+		len -= written;
+	}
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE int relay_buffered(int in, int out) {
+	static char buffer[RELAY_BUFFER_SIZE];
+	ssize_t count;
+	while ((count = read(in, buffer, sizeof(buffer))) != 0) {
+		if (count == FAIL_COND) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno;
+		}
+		int ret = write_all(out, buffer, count);
+		if (ret) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC int relay_replay(int captured, int out) {
+	if (lseek(captured, 0, SEEK_SET) == FAIL_COND) {
+		return errno;
+	}
+	return relay_copy(captured, out);
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int relay_copy(int in, int out) {
+	RelayMode mode = relay_mode(in, out);
+	if (mode != RELAY_MODE_COPY) {
+		int ret = relay_zero_copy(in, out, mode);
+		if (ret != FAIL_COND) {
+			return ret;
+		}
+	}
+	return relay_buffered(in, out);
+}
+
+// The last output takes the place of the dropped one
+LINKAGE_PRIVATE void drop_output(int* outs, size_t* teed, size_t* count, size_t i) {
+	close(outs[i]);
+	(*count)--;
+	outs[i] = outs[*count];
+	if (teed != NULL) {
+		teed[i] = teed[*count];
+	}
+}
+
+LINKAGE_PRIVATE int read_exact(int in, char* buffer, size_t len) {
+	while (len > 0) {
+		ssize_t count = read(in, buffer, len);
+		if (count == FAIL_COND && errno == EINTR) {
+			continue;
+		} else if (count <= 0) {
+			return count == 0 ? EIO : errno;
+		}
+		buffer += count;
+		len -= count;
+	}
+	return 0;
+}
+
+// Takes len bytes every output already holds off in, spliced into sink (/dev/null)
+LINKAGE_PRIVATE int discard(int in, int sink, size_t len) {
+	while (len > 0) {
+		ssize_t count = splice(in, NULL, sink, NULL, len, SPLICE_F_MOVE);
+		if (count == FAIL_COND && errno == EINTR) {
+			continue;
+		} else if (count <= 0) {
+			return count == 0 ? EIO : errno;
+		}
+		len -= count;
+	}
+	return 0;
+}
+
+/* Each round the first output takes whatever tee(...) can give it, every other
+ * output is offered the same. tee never consumes, so an output taking less is
+ * written the rest from a copy before the round is consumed.
+ * 0: Input exhausted or every output gone, -1: tee unsupported by these
+ * descriptors before any data moved, Otherwise: errno of the failed transfer
+ */
+__attribute__((hot))
+LINKAGE_PRIVATE int fan_out_tee(int in, int* outs, size_t* count, size_t* teed, int sink, char* buffer) {
+	bool moved = false;
+	while (*count > 0) {
+		size_t len = 0;
+		bool whole = true;
+		for (size_t i = 0; i < *count;) {
+			ssize_t duplicated = tee(in, outs[i], len == 0 ? RELAY_BUFFER_SIZE : len, 0);
+			if (duplicated == FAIL_COND) {
+				if (errno == EINTR) {
+					continue;
+				} else if (errno == EPIPE) {
+					drop_output(outs, teed, count, i);
+					continue;
+				}
+				return !moved && (errno == EINVAL || errno == ENOSYS) ? FAIL_COND : errno;
+			} else if (len == 0 && duplicated == 0) {
+				return 0;
+			} else if (len == 0) {
+				len = duplicated;
+			}
+			moved = true;
+			teed[i] = duplicated;
+			whole = whole && (size_t) duplicated == len;
+			i++;
+		}
+		if (len == 0) {
+			break;
+		} else if (whole && sink != FAIL_COND) {
+			int ret = discard(in, sink, len);
+			if (ret) {
+				return ret;
+			}
+			continue;
+		}
+		int ret = read_exact(in, buffer, len);
+		if (ret) {
+			return ret;
+		}
+		for (size_t i = 0; i < *count;) {
+			if ((ret = write_all(outs[i], buffer + teed[i], len - teed[i])) == EPIPE) {
+				drop_output(outs, teed, count, i);
+				continue;
+			} else if (ret) {
+				return ret;
+			}
+			i++;
+		}
+	}
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE int fan_out_buffered(int in, int* outs, size_t* count, char* buffer) {
+	while (*count > 0) {
+		ssize_t len = read(in, buffer, RELAY_BUFFER_SIZE);
+		if (len == 0) {
+			return 0;
+		} else if (len == FAIL_COND) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno;
+		}
+		for (size_t i = 0; i < *count;) {
+			int ret = write_all(outs[i], buffer, len);
+			if (ret == EPIPE) {
+				drop_output(outs, NULL, count, i);
+				continue;
+			} else if (ret) {
+				return ret;
+			}
+			i++;
+		}
+	}
+	return 0;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int relay_fan_out(int in, int* outs, size_t count) {
+	static char buffer[RELAY_BUFFER_SIZE];
+	int ret = FAIL_COND;
+	if (options.zeroCopy) {
+		size_t* teed = malloc(count * sizeof(*teed));
+		// Without it each round is consumed with a read into the buffer instead
+		int sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		if (teed != NULL) {
+			ret = fan_out_tee(in, outs, &count, teed, sink, buffer);
+		}
+		if (sink != FAIL_COND) {
+			close(sink);
+		}
+		free(teed);
+	}
+	if (ret == FAIL_COND) {
+		ret = fan_out_buffered(in, outs, &count, buffer);
+	}
+	for (size_t i = 0; i < count; i++) {
+		close(outs[i]);
+	}
+	return ret;
+}
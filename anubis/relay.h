@@ -0,0 +1,25 @@
+#ifndef ANUBIS_RELAY_H
+#define ANUBIS_RELAY_H
+
+#include <stddef.h>
+
+/* Moves data between two descriptors for in-process utilities. When either
+ * end is a pipe the pages are spliced across without passing through user
+ * space, regular files are sent with sendfile(...), and anything else (or a
+ * kernel refusing either) falls back to a buffered read/write loop.
+ */
+
+// 0: Input exhausted, Otherwise: errno of the failed read or write
+int relay_copy(int in, int out);
+// Copies everything written to captured (a memfd or file) from its start, as relay_copy(...)
+int relay_replay(int captured, int out);
+/* Copies everything read from in (a pipe) to each of outs (pipes), for a
+ * fan-out. tee(...) duplicates the input's pages into every output and they are
+ * then spliced away, so nothing passes through user space unless an output
+ * took only part of them. An output whose reader has gone (EPIPE, SIGPIPE must
+ * be ignored) is dropped and the rest carry on. Every output is closed on return.
+ * 0: Input exhausted or every output gone, Otherwise: errno of the failed transfer
+ */
+int relay_fan_out(int in, int* outs, size_t count);
+
+#endif // ANUBIS_RELAY_H
@@ -0,0 +1,162 @@
+#include "scan.h"
+
+#include "visibility.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* X-macro of the delimiter set, shared by the lookup table and the
+ * vector candidate check so the implementations cannot drift apart.
+ */
+#define SCAN_DELIMITERS(X) \
+	X('\0') \
+	X(' ') \
+	X('\t') \
+	X('\n') \
+	X('&') \
+	X('|') \
+	X('>') \
+	X(')') \
+	X('"') \
+	X('\'') \
+	X('\\')
+
+#define DELIMITER_ENTRY(c) [(unsigned char) (c)] = true,
+
+const bool scan_delimiters[256] = {
+	SCAN_DELIMITERS(DELIMITER_ENTRY)
+};
+
+const char* scan_impl_names[] = {
+	[SCAN_IMPL_AUTO] = "auto",
+	[SCAN_IMPL_SCALAR] = "scalar",
+	[SCAN_IMPL_SSE2] = "sse2",
+	[SCAN_IMPL_AVX2] = "avx2"
+};
+
+// Bytes scanned one at a time before handing the rest of a run to the selected scanner
+#define SCAN_SCALAR_PREFIX 16
+
+typedef size_t (*ScanFunction)(const char*, size_t);
+
+__attribute__((hot))
+LINKAGE_PRIVATE size_t scan_plain_scalar(const char* source, size_t len) {
+	size_t i = 0;
+	while (i < len && !scan_is_delimiter(source[i])) {
+		i++;
+	}
+	return i;
+}
+
+#ifdef SCAN_X86
+
+/* The vector scanners only flag candidate bytes: everything up to ')' plus '>', '\\' and '|'.
+ * That covers the delimiter set in four compares, each candidate is then settled
+ * against the lookup table so a '$' or '(' inside a word does not end it
+ */
+#define CANDIDATE_MAX ')'
+#define IS_CANDIDATE(c) ((unsigned char) (c) <= CANDIDATE_MAX || (c) == '>' || (c) == '\\' || (c) == '|')
+#define CANDIDATE_ASSERT(c) _Static_assert(IS_CANDIDATE(c), "delimiter missed by the vector candidates");
+
+SCAN_DELIMITERS(CANDIDATE_ASSERT)
+
+// Position of the first delimiter among the candidate bits of mask, or -1
+LINKAGE_PRIVATE int scan_candidates(const char* block, unsigned int mask) {
+	while (mask != 0) {
+		int bit = __builtin_ctz(mask);
+		if (scan_is_delimiter(block[bit])) {
+			return bit;
+		}
+		mask &= mask - 1;
+	}
+	return -1;
+}
+
+__attribute__((hot, target("sse2")))
+LINKAGE_PRIVATE size_t scan_plain_sse2(const char* source, size_t len) {
+	const __m128i low = _mm_set1_epi8(CANDIDATE_MAX);
+	const __m128i greater = _mm_set1_epi8('>');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i pipe = _mm_set1_epi8('|');
+	size_t i = 0;
+	for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+		__m128i block = _mm_loadu_si128((const __m128i*) &source[i]);
+		// Unsigned block <= CANDIDATE_MAX, as min(block, max) == block
+		__m128i candidates = _mm_cmpeq_epi8(_mm_min_epu8(block, low), block)
+			| _mm_cmpeq_epi8(block, greater)
+			| _mm_cmpeq_epi8(block, backslash)
+			| _mm_cmpeq_epi8(block, pipe);
+		unsigned int mask = _mm_movemask_epi8(candidates);
+		if (mask != 0) {
+			int found = scan_candidates(&source[i], mask);
+			if (found >= 0) {
+				return i + found;
+			}
+		}
+	}
+	return i + scan_plain_scalar(&source[i], len - i);
+}
+
+__attribute__((hot, target("avx2")))
+LINKAGE_PRIVATE size_t scan_plain_avx2(const char* source, size_t len) {
+	const __m256i low = _mm256_set1_epi8(CANDIDATE_MAX);
+	const __m256i greater = _mm256_set1_epi8('>');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i pipe = _mm256_set1_epi8('|');
+	size_t i = 0;
+	for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+		__m256i block = _mm256_loadu_si256((const __m256i*) &source[i]);
+		__m256i candidates = _mm256_cmpeq_epi8(_mm256_min_epu8(block, low), block)
+			| _mm256_cmpeq_epi8(block, greater)
+			| _mm256_cmpeq_epi8(block, backslash)
+			| _mm256_cmpeq_epi8(block, pipe);
+		unsigned int mask = _mm256_movemask_epi8(candidates);
+		if (mask != 0) {
+			int found = scan_candidates(&source[i], mask);
+			if (found >= 0) {
+				return i + found;
+			}
+		}
+	}
+	// The tail is shorter than a block, the scalar scan is cheaper than another vector setup
+	return i + scan_plain_scalar(&source[i], len - i);
+}
+
+#endif // SCAN_X86
+
+static ScanFunction scan_function = scan_plain_scalar;
+
+LINKAGE_PUBLIC ScanImpl scan_init(ScanImpl impl) {
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	bool avx2 = __builtin_cpu_supports("avx2");
+	bool sse2 = __builtin_cpu_supports("sse2");
+	if (impl == SCAN_IMPL_AUTO) {
+		impl = avx2 ? SCAN_IMPL_AVX2 : sse2 ? SCAN_IMPL_SSE2 : SCAN_IMPL_SCALAR;
+	}
+	// Fall back to the scalar scanner when the requested extension is missing
+	if (impl == SCAN_IMPL_AVX2 && avx2) {
+		scan_function = scan_plain_avx2;
+		return SCAN_IMPL_AVX2;
+	} else if (impl == SCAN_IMPL_SSE2 && sse2) {
+		scan_function = scan_plain_sse2;
+		return SCAN_IMPL_SSE2;
+	}
+#endif // SCAN_X86
+	scan_function = scan_plain_scalar;
+	return SCAN_IMPL_SCALAR;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC size_t scan_plain(const char* source, size_t len) {
+	// Most runs are a short word that ends before a vector scan pays for its setup
+	size_t i = 0;
+	for (; i < len && i < SCAN_SCALAR_PREFIX; i++) {
+		if (scan_is_delimiter(source[i])) {
+			return i;
+		}
+	}
+	return i + scan_function(&source[i], len - i);
+}
@@ -0,0 +1,27 @@
+#ifndef ANUBIS_SCAN_H
+#define ANUBIS_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum ScanImpl {
+	SCAN_IMPL_AUTO,
+	SCAN_IMPL_SCALAR,
+	SCAN_IMPL_SSE2,
+	SCAN_IMPL_AVX2
+} ScanImpl;
+
+extern const char* scan_impl_names[];
+
+// Bytes that end a run of plain (unquoted, unescaped) string characters
+extern const bool scan_delimiters[256];
+
+#define scan_is_delimiter(c) (scan_delimiters[(unsigned char) (c)])
+
+// Select the scanner, AUTO picks the widest supported by the CPU. Returns the implementation in use
+ScanImpl scan_init(ScanImpl impl);
+
+// Length of the run of plain characters at the start of source
+size_t scan_plain(const char* source, size_t len);
+
+#endif // ANUBIS_SCAN_H
@@ -0,0 +1,582 @@
+#define _GNU_SOURCE
+
+#include "script_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "checks.h"
+#include "hash_utils.h"
+#include "lexer.h"
+#include "options.h"
+#include "parser.h"
+#include "mem_utils.h"
+#include "visibility.h"
+
+/* File layout, all integers native endian (the cache is per machine):
+ *
+ * ScriptHeader         with HEADER_FLAG_SOURCE_ONLY, only the real path follows
+ * InputLineRecord[]    one per script line, its CommandLines or its deferred errors
+ * CommandLineRecord[]  CommandLines of all tables, consecutive per table
+ * CommandRecord[]      Commands of all pipelines, consecutive per pipeline and followed by its fan-out branches
+ * uint64_t[]           argument string offsets, consecutive per command (args[0] is the command)
+ * char[]               NUL terminated strings and deferred error messages, referenced by offset
+ *
+ * Every section starts 8 byte aligned and is referenced by offset and count
+ * from the header, so a mapping of the file is usable in place.
+ */
+#define SCRIPT_CACHE_MAGIC "ANBSCRPT"
+#define SCRIPT_CACHE_VERSION 4
+#define SCRIPT_CACHE_SUFFIX ".anubisc"
+#define SECTION_ALIGNMENT 8
+#define NO_STRING UINT64_MAX
+#define LINE_FLAG_BACKGROUND 0x1
+#define LINE_FLAG_TIMED 0x2
+// The script uses what the cache cannot store (process substitution), it runs from its source
+#define HEADER_FLAG_SOURCE_ONLY 0x1
+#define FAIL_COND -1
+
+typedef enum Section {
+	SECTION_INPUT_LINES,
+	SECTION_COMMAND_LINES,
+	SECTION_COMMANDS,
+	SECTION_ARGS,
+	SECTION_STRINGS,
+	SECTION_COUNT
+} Section;
+
+typedef struct SectionRef {
+	uint64_t offset;
+	uint64_t count;
+} SectionRef;
+
+typedef struct ScriptHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint64_t fileSize;
+	int64_t mtimeSec;
+	int64_t mtimeNsec;
+	uint64_t scriptSize;
+	uint64_t contentHash;
+	// Real path of the script, guards against hash collisions of the file name
+	uint64_t path;
+	uint32_t flags;
+	uint32_t reserved;
+	SectionRef sections[SECTION_COUNT];
+} ScriptHeader;
+
+typedef struct InputLineRecord {
+	uint64_t firstLine;
+	uint32_t lineCount;
+	// Failed to parse, the deferred errors are raised instead of executing it
+	uint32_t failed;
+	uint64_t errors;
+	// The errors' messages, back to back in the strings, NO_STRING: none
+	uint64_t messages;
+	uint64_t messagesLength;
+} InputLineRecord;
+
+typedef struct CommandLineRecord {
+	uint64_t firstCommand;
+	uint32_t pipeCount;
+	uint32_t flags;
+	uint64_t outTrunc;
+	uint32_t branchCount;
+	uint32_t reserved;
+} CommandLineRecord;
+
+typedef struct CommandRecord {
+	uint64_t firstArg;
+	uint64_t argCount;
+} CommandRecord;
+
+static const size_t sectionElementSizes[SECTION_COUNT] = {
+	[SECTION_INPUT_LINES] = sizeof(InputLineRecord),
+	[SECTION_COMMAND_LINES] = sizeof(CommandLineRecord),
+	[SECTION_COMMANDS] = sizeof(CommandRecord),
+	[SECTION_ARGS] = sizeof(uint64_t),
+	[SECTION_STRINGS] = sizeof(char)
+};
+
+struct CompiledScript {
+	char* base;
+	size_t size;
+	// true: base is a mapping of the cache file, false: a heap buffer compiled this run
+	bool mapped;
+	ScriptHeader* header;
+	InputLineRecord* inputs;
+	CommandLineRecord* lines;
+	CommandRecord* commands;
+	uint64_t* args;
+	char* strings;
+};
+
+typedef struct Buffer {
+	char* data;
+	size_t len;
+	size_t capacity;
+} Buffer;
+
+typedef struct Builder {
+	Buffer sections[SECTION_COUNT];
+	uint64_t contentHash;
+} Builder;
+
+LINKAGE_PRIVATE void* buffer_append(Buffer* buffer, const void* data, size_t len) {
+	if (buffer->len + len > buffer->capacity) {
+		size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+		while (capacity < buffer->len + len) {
+			capacity *= 2;
+		}
+		char* resized = realloc(buffer->data, capacity);
+		INSTANCE_NULL_CHECK_RETURN("script cache buffer", resized, NULL);
+		buffer->data = resized;
+		buffer->capacity = capacity;
+	}
+	void* target = &buffer->data[buffer->len];
+	memcpy(target, data, len);
+	buffer->len += len;
+	return target;
+}
+
+LINKAGE_TRANSPARENT uint64_t section_count(Builder* builder, Section section) {
+	return builder->sections[section].len / sectionElementSizes[section];
+}
+
+LINKAGE_PRIVATE uint64_t builder_string(Builder* builder, const char* str) {
+	if (str == NULL) {
+		return NO_STRING;
+	}
+	uint64_t offset = builder->sections[SECTION_STRINGS].len;
+	if (buffer_append(&builder->sections[SECTION_STRINGS], str, strlen(str) + 1) == NULL) {
+		return NO_STRING;
+	}
+	return offset;
+}
+
+LINKAGE_PRIVATE int builder_command(Builder* builder, Command* command) {
+	if (command->substitutionCount > 0) {
+		// Not stored, a script using them runs from its source
+		return ENOTSUP;
+	}
+	CommandRecord record = {
+		.firstArg = section_count(builder, SECTION_ARGS),
+		// Without the NULL terminator
+		.argCount = command->argCount - 1
+	};
+	for (size_t i = 0; i < record.argCount; i++) {
+		uint64_t offset = builder_string(builder, command->args[i]);
+		if (offset == NO_STRING || buffer_append(&builder->sections[SECTION_ARGS], &offset, sizeof(offset)) == NULL) {
+			return ENOMEM;
+		}
+	}
+	return buffer_append(&builder->sections[SECTION_COMMANDS], &record, sizeof(record)) == NULL ? ENOMEM : 0;
+}
+
+LINKAGE_PRIVATE int builder_table(Builder* builder, CommandTable* table, ErrorSink* errors) {
+	InputLineRecord input = {
+		.firstLine = section_count(builder, SECTION_COMMAND_LINES),
+		.lineCount = table == NULL ? 0 : table->lineCount,
+		.failed = table == NULL,
+		.errors = errors->count,
+		.messages = NO_STRING,
+		.messagesLength = errors->length
+	};
+	if (errors->length > 0) {
+		input.messages = builder->sections[SECTION_STRINGS].len;
+		if (buffer_append(&builder->sections[SECTION_STRINGS], errors->messages, errors->length) == NULL) {
+			return ENOMEM;
+		}
+	}
+	// Each table's line records are consecutive, their commands go to a section of their own
+	for (size_t i = 0; i < input.lineCount; i++) {
+		CommandLine* line = table->lines[i];
+		CommandLineRecord record = {
+			.firstCommand = section_count(builder, SECTION_COMMANDS),
+			.pipeCount = line->pipeCount,
+			.flags = (line->bgOp ? LINE_FLAG_BACKGROUND : 0) | (line->timed ? LINE_FLAG_TIMED : 0),
+			.outTrunc = NO_STRING,
+			.branchCount = line->branchCount
+		};
+		for (size_t j = 0; j < line->pipeCount + line->branchCount; j++) {
+			int err = builder_command(builder, command_line_stage(line, j));
+			if (err) {
+				return err;
+			}
+		}
+		if (line->ioModifiers != NULL && line->ioModifiers->outTrunc != NULL
+			&& (record.outTrunc = builder_string(builder, line->ioModifiers->outTrunc)) == NO_STRING) {
+			return ENOMEM;
+		}
+		if (buffer_append(&builder->sections[SECTION_COMMAND_LINES], &record, sizeof(record)) == NULL) {
+			return ENOMEM;
+		}
+	}
+	return buffer_append(&builder->sections[SECTION_INPUT_LINES], &input, sizeof(input)) == NULL ? ENOMEM : 0;
+}
+
+LINKAGE_TRANSPARENT size_t align_section(size_t offset) {
+	return (offset + SECTION_ALIGNMENT - 1) & ~(size_t) (SECTION_ALIGNMENT - 1);
+}
+
+LINKAGE_PRIVATE void compiled_attach(CompiledScript* compiled) {
+	ScriptHeader* header = (ScriptHeader*) compiled->base;
+	compiled->header = header;
+	compiled->inputs = (InputLineRecord*) &compiled->base[header->sections[SECTION_INPUT_LINES].offset];
+	compiled->lines = (CommandLineRecord*) &compiled->base[header->sections[SECTION_COMMAND_LINES].offset];
+	compiled->commands = (CommandRecord*) &compiled->base[header->sections[SECTION_COMMANDS].offset];
+	compiled->args = (uint64_t*) &compiled->base[header->sections[SECTION_ARGS].offset];
+	compiled->strings = &compiled->base[header->sections[SECTION_STRINGS].offset];
+}
+
+// Lay the sections out behind the header in one buffer, the form written to disk
+LINKAGE_PRIVATE CompiledScript* builder_finish(Builder* builder, struct stat* scriptStat, const char* realPath, uint32_t flags) {
+	uint64_t path = builder_string(builder, realPath);
+	if (path == NO_STRING) {
+		return NULL;
+	}
+	ScriptHeader header = {
+		.version = SCRIPT_CACHE_VERSION,
+		.headerSize = sizeof(ScriptHeader),
+		.mtimeSec = scriptStat->st_mtim.tv_sec,
+		.mtimeNsec = scriptStat->st_mtim.tv_nsec,
+		.scriptSize = scriptStat->st_size,
+		.contentHash = builder->contentHash,
+		.path = path,
+		.flags = flags
+	};
+	memcpy(header.magic, SCRIPT_CACHE_MAGIC, sizeof(header.magic));
+	size_t size = align_section(sizeof(header));
+	for (Section section = 0; section < SECTION_COUNT; section++) {
+		header.sections[section] = (SectionRef) { size, section_count(builder, section) };
+		size = align_section(size + builder->sections[section].len);
+	}
+	header.fileSize = size;
+	CompiledScript* compiled = calloc(1, sizeof(*compiled));
+	INSTANCE_NULL_CHECK_RETURN("compiled script", compiled, NULL);
+	if ((compiled->base = calloc(1, size)) == NULL) {
+		free(compiled);
+		return NULL;
+	}
+	compiled->size = size;
+	memcpy(compiled->base, &header, sizeof(header));
+	for (Section section = 0; section < SECTION_COUNT; section++) {
+		Buffer* buffer = &builder->sections[section];
+		if (buffer->len > 0) {
+			memcpy(&compiled->base[header.sections[section].offset], buffer->data, buffer->len);
+		}
+	}
+	compiled_attach(compiled);
+	return compiled;
+}
+
+LINKAGE_PRIVATE void builder_free(Builder* builder) {
+	for (Section section = 0; section < SECTION_COUNT; section++) {
+		checked_free(builder->sections[section].data);
+	}
+}
+
+/* Parse every line of the script with errors deferred, as shell_stream would reach them.
+ * NULL: Unable to compile, Otherwise: the compiled script, or with HEADER_FLAG_SOURCE_ONLY
+ * the marker to store for a script that cannot be
+ */
+LINKAGE_PRIVATE CompiledScript* compile(FILE* stream, struct stat* scriptStat, const char* realPath) {
+	Builder builder = { .contentHash = FNV_OFFSET_BASIS };
+	Arena* arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE);
+	INSTANCE_NULL_CHECK_RETURN("compile arena", arena, NULL);
+	Parser parser = parser_default(arena);
+	Lexer lexer;
+	char* line = NULL;
+	size_t len = 0;
+	ssize_t count;
+	int err = 0;
+	while ((err == 0 || err == ENOTSUP) && (count = getline(&line, &len, stream)) > 0) {
+		builder.contentHash = fnv1a(builder.contentHash, line, count);
+		if (err) {
+			// Only hashed, the marker is keyed on the whole script like a compiled one
+			continue;
+		}
+		arena_reset(arena);
+		lexer_reset(&lexer, line);
+		ErrorSink sink = { .arena = arena };
+		ErrorSink* previous = error_capture(&sink);
+		CommandTable* table = parse(&parser, &lexer);
+		error_capture(previous);
+		err = builder_table(&builder, table, &sink);
+	}
+	checked_free(line);
+	arena_free(arena);
+	if (err == ENOTSUP) {
+		builder_free(&builder);
+		builder = (Builder) { .contentHash = builder.contentHash };
+	}
+	CompiledScript* compiled = err == 0 || err == ENOTSUP
+		? builder_finish(&builder, scriptStat, realPath, err == ENOTSUP ? HEADER_FLAG_SOURCE_ONLY : 0)
+		: NULL;
+	builder_free(&builder);
+	return compiled;
+}
+
+LINKAGE_PRIVATE char* cache_file_name(const char* realPath) {
+	char* name = NULL;
+	uint64_t hash = fnv1a(FNV_OFFSET_BASIS, realPath, strlen(realPath));
+	if (asprintf(&name, "%s/%016llx" SCRIPT_CACHE_SUFFIX, options.scriptCache, (unsigned long long) hash) == FAIL_COND) {
+		return NULL;
+	}
+	return name;
+}
+
+// Written beside the target and renamed over it, so readers never see a partial file
+LINKAGE_PRIVATE void store(CompiledScript* compiled, const char* cacheFile) {
+	char* temporary = NULL;
+	if (mkdir(options.scriptCache, S_IRWXU) == FAIL_COND && errno != EEXIST) {
+		return;
+	} else if (asprintf(&temporary, "%s.%d", cacheFile, getpid()) == FAIL_COND) {
+		return;
+	}
+	int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	bool written = fd != FAIL_COND;
+	for (size_t offset = 0; written && offset < compiled->size;) {
+		ssize_t count = write(fd, &compiled->base[offset], compiled->size - offset);
+		if (count == FAIL_COND && errno == EINTR) {
+			continue;
+		}
+		written = count > 0;
+		offset += written ? count : 0;
+	}
+	if (fd != FAIL_COND) {
+		written &= close(fd) == 0;
+	}
+	if (!written || rename(temporary, cacheFile) == FAIL_COND) {
+		// Caching is best effort, the compiled script is still used for this run
+		unlink(temporary);
+	}
+	free(temporary);
+}
+
+LINKAGE_TRANSPARENT bool section_valid(ScriptHeader* header, Section section, size_t size) {
+	SectionRef* ref = &header->sections[section];
+	return ref->offset % SECTION_ALIGNMENT == 0
+		&& ref->offset <= size
+		&& ref->count <= (size - ref->offset) / sectionElementSizes[section];
+}
+
+LINKAGE_TRANSPARENT bool string_valid(CompiledScript* compiled, uint64_t offset) {
+	return offset < compiled->header->sections[SECTION_STRINGS].count;
+}
+
+// Bounds check every record once, so tables can be rebuilt without further checks
+LINKAGE_PRIVATE bool validate(CompiledScript* compiled) {
+	ScriptHeader* header = compiled->header;
+	uint64_t counts[SECTION_COUNT];
+	for (Section section = 0; section < SECTION_COUNT; section++) {
+		counts[section] = header->sections[section].count;
+	}
+	if (counts[SECTION_STRINGS] == 0 || compiled->strings[counts[SECTION_STRINGS] - 1] != '\0') {
+		return false;
+	}
+	for (uint64_t i = 0; i < counts[SECTION_INPUT_LINES]; i++) {
+		InputLineRecord* input = &compiled->inputs[i];
+		if (input->firstLine > counts[SECTION_COMMAND_LINES] || input->lineCount > counts[SECTION_COMMAND_LINES] - input->firstLine) {
+			return false;
+		} else if (input->messages != NO_STRING && (
+			input->messages >= counts[SECTION_STRINGS]
+			|| input->messagesLength == 0
+			|| input->messagesLength > counts[SECTION_STRINGS] - input->messages
+			|| compiled->strings[input->messages + input->messagesLength - 1] != '\0'
+		)) {
+			return false;
+		}
+	}
+	for (uint64_t i = 0; i < counts[SECTION_COMMAND_LINES]; i++) {
+		CommandLineRecord* line = &compiled->lines[i];
+		if (line->firstCommand > counts[SECTION_COMMANDS]
+			|| (uint64_t) line->pipeCount + line->branchCount > counts[SECTION_COMMANDS] - line->firstCommand
+			|| (line->outTrunc != NO_STRING && !string_valid(compiled, line->outTrunc))) {
+			return false;
+		}
+	}
+	for (uint64_t i = 0; i < counts[SECTION_COMMANDS]; i++) {
+		CommandRecord* command = &compiled->commands[i];
+		if (command->argCount == 0 || command->firstArg > counts[SECTION_ARGS] || command->argCount > counts[SECTION_ARGS] - command->firstArg) {
+			return false;
+		}
+	}
+	for (uint64_t i = 0; i < counts[SECTION_ARGS]; i++) {
+		if (!string_valid(compiled, compiled->args[i])) {
+			return false;
+		}
+	}
+	return string_valid(compiled, header->path);
+}
+
+LINKAGE_PRIVATE bool content_matches(int fd, size_t size, uint64_t expected) {
+	if (size == 0) {
+		return expected == FNV_OFFSET_BASIS;
+	}
+	void* content = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (content == MAP_FAILED) {
+		return false;
+	}
+	bool matches = fnv1a(FNV_OFFSET_BASIS, content, size) == expected;
+	munmap(content, size);
+	return matches;
+}
+
+// NULL: Missing, stale or corrupt
+LINKAGE_PRIVATE CompiledScript* load(const char* cacheFile, int scriptFd, struct stat* scriptStat, const char* realPath) {
+	int fd = open(cacheFile, O_RDONLY | O_CLOEXEC);
+	if (fd == FAIL_COND) {
+		return NULL;
+	}
+	struct stat cacheStat;
+	void* base = MAP_FAILED;
+	if (fstat(fd, &cacheStat) == 0 && (size_t) cacheStat.st_size >= sizeof(ScriptHeader)) {
+		// Private and writable, nothing downstream may modify the strings but a stray write must not fault
+		base = mmap(NULL, cacheStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	CompiledScript compiled = { .base = base, .size = cacheStat.st_size, .mapped = true };
+	ScriptHeader* header = base;
+	bool valid = memcmp(header->magic, SCRIPT_CACHE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == SCRIPT_CACHE_VERSION
+		&& header->headerSize == sizeof(ScriptHeader)
+		&& header->fileSize == compiled.size
+		&& header->mtimeSec == scriptStat->st_mtim.tv_sec
+		&& header->mtimeNsec == scriptStat->st_mtim.tv_nsec
+		&& header->scriptSize == (uint64_t) scriptStat->st_size;
+	for (Section section = 0; valid && section < SECTION_COUNT; section++) {
+		valid = section_valid(header, section, compiled.size);
+	}
+	if (valid) {
+		compiled_attach(&compiled);
+	}
+	valid = valid && validate(&compiled)
+		&& strcmp(&compiled.strings[header->path], realPath) == 0
+		&& content_matches(scriptFd, scriptStat->st_size, header->contentHash);
+	CompiledScript* result = valid ? malloc(sizeof(*result)) : NULL;
+	if (result == NULL) {
+		munmap(base, compiled.size);
+		return NULL;
+	}
+	*result = compiled;
+	return result;
+}
+
+LINKAGE_PUBLIC CompiledScript* script_cache_open(const char* script) {
+	FILE* stream = fopen(script, "re");
+	if (stream == NULL) {
+		return NULL;
+	}
+	struct stat scriptStat;
+	char* realPath = realpath(script, NULL);
+	char* cacheFile = realPath == NULL ? NULL : cache_file_name(realPath);
+	CompiledScript* compiled = NULL;
+	if (cacheFile != NULL && fstat(fileno(stream), &scriptStat) == 0 && S_ISREG(scriptStat.st_mode)) {
+		if ((compiled = load(cacheFile, fileno(stream), &scriptStat, realPath)) == NULL
+			&& (compiled = compile(stream, &scriptStat, realPath)) != NULL) {
+			store(compiled, cacheFile);
+		}
+		if (compiled != NULL && compiled->header->flags & HEADER_FLAG_SOURCE_ONLY) {
+			script_cache_close(compiled);
+			compiled = NULL;
+		}
+	}
+	fclose(stream);
+	checked_free(cacheFile);
+	checked_free(realPath);
+	return compiled;
+}
+
+LINKAGE_PUBLIC void script_cache_close(CompiledScript* compiled) {
+	if (compiled == NULL) {
+		return;
+	} else if (compiled->mapped) {
+		munmap(compiled->base, compiled->size);
+	} else {
+		free(compiled->base);
+	}
+	free(compiled);
+}
+
+LINKAGE_PUBLIC size_t compiled_script_lines(CompiledScript* compiled) {
+	return compiled->header->sections[SECTION_INPUT_LINES].count;
+}
+
+LINKAGE_PRIVATE Command* rebuild_command(CompiledScript* compiled, CommandRecord* record, Arena* arena) {
+	Args args = arena_alloc(arena, (record->argCount + 1) * sizeof(*args));
+	INSTANCE_NULL_CHECK_RETURN("args", args, NULL);
+	for (uint64_t i = 0; i < record->argCount; i++) {
+		args[i] = &compiled->strings[compiled->args[record->firstArg + i]];
+	}
+	args[record->argCount] = NULL;
+	return command_new(arena, args[0], args, record->argCount + 1, NULL, 0);
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC CommandTable* compiled_script_table(CompiledScript* compiled, size_t index, Arena* arena, ErrorSink* errors) {
+	InputLineRecord* input = &compiled->inputs[index];
+	*errors = (ErrorSink) {
+		.count = input->errors,
+		.messages = input->messages == NO_STRING ? NULL : &compiled->strings[input->messages],
+		.length = input->messagesLength
+	};
+	if (input->failed) {
+		return NULL;
+	}
+	CommandTable* table = command_table_new(arena);
+	INSTANCE_NULL_CHECK_RETURN("CommandTable", table, NULL);
+	table->lines = arena_calloc(arena, input->lineCount + 1, sizeof(*table->lines));
+	INSTANCE_NULL_CHECK_RETURN("command lines", table->lines, NULL);
+	for (uint32_t i = 0; i < input->lineCount; i++) {
+		CommandLineRecord* record = &compiled->lines[input->firstLine + i];
+		PipeList pipes = arena_calloc(arena, record->pipeCount + 1, sizeof(*pipes));
+		INSTANCE_NULL_CHECK_RETURN("pipes", pipes, NULL);
+		for (uint32_t j = 0; j < record->pipeCount; j++) {
+			if ((pipes[j] = rebuild_command(compiled, &compiled->commands[record->firstCommand + j], arena)) == NULL) {
+				return NULL;
+			}
+		}
+		PipeList branches = NULL;
+		if (record->branchCount > 0) {
+			branches = arena_calloc(arena, record->branchCount + 1, sizeof(*branches));
+			INSTANCE_NULL_CHECK_RETURN("branches", branches, NULL);
+		}
+		for (uint32_t j = 0; j < record->branchCount; j++) {
+			CommandRecord* command = &compiled->commands[record->firstCommand + record->pipeCount + j];
+			if ((branches[j] = rebuild_command(compiled, command, arena)) == NULL) {
+				return NULL;
+			}
+		}
+		IoModifiers* modifiers = io_modifiers_new(arena, record->outTrunc == NO_STRING ? NULL : &compiled->strings[record->outTrunc]);
+		table->lines[i] = command_line_new(
+			arena,
+			pipes,
+			record->pipeCount,
+			branches,
+			record->branchCount,
+			modifiers,
+			(record->flags & LINE_FLAG_BACKGROUND) != 0,
+			(record->flags & LINE_FLAG_TIMED) != 0
+		);
+		if (modifiers == NULL || table->lines[i] == NULL) {
+			return NULL;
+		}
+	}
+	table->lineCount = input->lineCount;
+	return table;
+}
@@ -0,0 +1,33 @@
+#ifndef ANUBIS_SCRIPT_CACHE_H
+#define ANUBIS_SCRIPT_CACHE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "error.h"
+#include "structure.h"
+
+/* Batch scripts compiled ahead of execution: every input line is parsed
+ * once and stored in a flat, offset based file (see script_cache.c) under
+ * options.scriptCache, named by the hash of the script's real path. Later
+ * runs map that file and rebuild each line's CommandTable from it without
+ * lexing or parsing, provided the script's size, mtime and content hash match.
+ * Parse errors are kept as deferred error records with their messages, raised when the line is reached.
+ * A script the cache cannot store is recorded as such, under the same checks,
+ * so later runs go straight to its source without compiling it again.
+ */
+
+typedef struct CompiledScript CompiledScript;
+
+// NULL: Unable to read the script or run from its source, Otherwise: loaded from the cache or compiled (and stored) now
+CompiledScript* script_cache_open(const char* script);
+void script_cache_close(CompiledScript* compiled);
+
+// Input lines of the script, in order
+size_t compiled_script_lines(CompiledScript* compiled);
+/* Rebuild input line index from the arena, referencing the compiled strings.
+ * NULL: the line failed to parse, errors holds the deferred errors to raise
+ */
+CommandTable* compiled_script_table(CompiledScript* compiled, size_t index, Arena* arena, ErrorSink* errors);
+
+#endif // ANUBIS_SCRIPT_CACHE_H
@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "checks.h"
+#include "path.h"
+#include "zygote.h"
+#include "mem_utils.h"
+#include "visibility.h"
+
+#define FAIL_COND -1
+// Descriptors attached to a line: stdin, stdout and stderr
+#define STDIO_COUNT 3
+
+typedef union StdioControl {
+	char buffer[CMSG_SPACE(sizeof(int) * STDIO_COUNT)];
+	struct cmsghdr align;
+} StdioControl;
+
+LINKAGE_PRIVATE int socket_address(const char* socketPath, struct sockaddr_un* address) {
+	*address = (struct sockaddr_un) { .sun_family = AF_UNIX };
+	if (strlen(socketPath) >= sizeof(address->sun_path)) {
+		return ENAMETOOLONG;
+	}
+	strcpy(address->sun_path, socketPath);
+	return 0;
+}
+
+// 0: Read size bytes, EPIPE: The peer closed the connection first, Otherwise: errno of the failed read
+LINKAGE_PRIVATE int read_full(int fd, void* buffer, size_t size) {
+	for (size_t done = 0; done < size;) {
+		ssize_t count = read(fd, (char*) buffer + done, size - done);
+		if (count == FAIL_COND && errno == EINTR) {
+			continue;
+		} else if (count == FAIL_COND) {
+			return errno;
+		} else if (count == 0) {
+			return EPIPE;
+		}
+		done += count;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE int write_full(int fd, const void* buffer, size_t size) {
+	for (size_t done = 0; done < size;) {
+		// A vanished peer is reported rather than raising SIGPIPE
+		ssize_t count = send(fd, (const char*) buffer + done, size - done, MSG_NOSIGNAL);
+		if (count == FAIL_COND && errno == EINTR) {
+			continue;
+		} else if (count == FAIL_COND) {
+			return errno;
+		}
+		done += count;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE void close_all(int* fds, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		close(fds[i]);
+	}
+}
+
+/* Receives a line frame, the descriptors arrive with its first byte.
+ * 0: line holds the NUL terminated line, EPIPE: Connection closed, Otherwise: errno
+ */
+LINKAGE_PRIVATE int receive_line(int conn, char** line, size_t* capacity, int fds[STDIO_COUNT], size_t* fdCount) {
+	ServerFrame frame;
+	StdioControl control;
+	struct iovec iov = { &frame, sizeof(frame) };
+	struct msghdr message = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer)
+	};
+	ssize_t count;
+	while ((count = recvmsg(conn, &message, MSG_CMSG_CLOEXEC)) == FAIL_COND && errno == EINTR);
+	if (count == FAIL_COND) {
+		return errno;
+	} else if (count == 0) {
+		return EPIPE;
+	}
+	*fdCount = 0;
+	for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)) {
+		if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+			size_t received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			*fdCount = received < STDIO_COUNT ? received : STDIO_COUNT;
+			memcpy(fds, CMSG_DATA(header), *fdCount * sizeof(int));
+		}
+	}
+	int ret = 0;
+	if (message.msg_flags & MSG_CTRUNC) {
+		ret = EPROTO;
+	} else if ((size_t) count < sizeof(frame)) {
+		ret = read_full(conn, (char*) &frame + count, sizeof(frame) - count);
+	}
+	if (ret == 0 && (frame.type != SERVER_FRAME_LINE || frame.length > SERVER_LINE_MAX)) {
+		ret = EPROTO;
+	}
+	if (ret == 0 && frame.length + 1 > *capacity) {
+		char* grown = realloc(*line, frame.length + 1);
+		if (grown == NULL) {
+			ret = ENOMEM;
+		} else {
+			*line = grown;
+			*capacity = frame.length + 1;
+		}
+	}
+	if (ret == 0 && (ret = read_full(conn, *line, frame.length)) == 0) {
+		(*line)[frame.length] = '\0';
+	}
+	if (ret != 0) {
+		close_all(fds, *fdCount);
+	}
+	return ret;
+}
+
+// The client's descriptors replace this session's stdio for the line and everything it starts
+LINKAGE_PRIVATE int install_stdio(int fds[STDIO_COUNT], size_t count) {
+	int err = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (fds[i] != (int) i) {
+			if (dup2(fds[i], (int) i) == FAIL_COND && err == 0) {
+				err = errno;
+			}
+			close(fds[i]);
+		}
+	}
+	return err;
+}
+
+LINKAGE_PRIVATE int send_status(int conn, int status) {
+	struct {
+		ServerFrame frame;
+		int32_t status;
+	} reply = { { SERVER_FRAME_STATUS, sizeof(int32_t) }, status };
+	return write_full(conn, &reply, sizeof(reply));
+}
+
+// Only the user running the server may have lines executed by it
+LINKAGE_PRIVATE bool peer_trusted(int conn) {
+	struct ucred peer;
+	socklen_t length = sizeof(peer);
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &length)) {
+		ERROR(errno, "Unable to identify a client");
+		return false;
+	} else if (peer.uid != geteuid()) {
+		ERROR(EPERM, "Refused a session from user %u", (unsigned) peer.uid);
+		return false;
+	}
+	return true;
+}
+
+__attribute__((noreturn))
+LINKAGE_PRIVATE void session_run(int conn, ServerHandler handler) {
+	if (!peer_trusted(conn)) {
+		close(conn);
+		exit(1);
+	}
+	// Changes to the path seen by one session must not be consumed on behalf of another
+	path_rewatch();
+	// The zygote's children would be the server's, not this session's
+	zygote_detach();
+	char* line = NULL;
+	size_t capacity = 0;
+	int fds[STDIO_COUNT];
+	size_t fdCount;
+	while (receive_line(conn, &line, &capacity, fds, &fdCount) == 0) {
+		int status = install_stdio(fds, fdCount) ? 1 : handler(line);
+		// Anything buffered belongs to this client, not the next one
+		fflush(stdout);
+		fflush(stderr);
+		if (send_status(conn, status)) {
+			break;
+		}
+	}
+	checked_free(line);
+	close(conn);
+	// Background jobs are waited on by the exit handler, as at the end of a script
+	exit(0);
+}
+
+LINKAGE_PUBLIC int server_run(const char* socketPath, ServerHandler handler) {
+	struct sockaddr_un address;
+	int ret;
+	transparent_return(socket_address(socketPath, &address));
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener == FAIL_COND) {
+		return errno;
+	}
+	// Replace the socket of a previous server, never any other kind of file
+	struct stat info;
+	if (lstat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode)) {
+		unlink(socketPath);
+	}
+	// The socket is created owner only, whatever the process umask
+	mode_t mask = umask(077);
+	int bound = bind(listener, (struct sockaddr*) &address, sizeof(address));
+	umask(mask);
+	if (bound || listen(listener, SOMAXCONN)) {
+		ret = errno;
+		close(listener);
+		return ret;
+	}
+	// Sessions inherit the cache, so no client pays for the path lookups
+	path_prime();
+	for (;;) {
+		int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		// Sessions that have ended are reaped as new connections arrive
+		while (waitpid(-1, NULL, WNOHANG) > 0);
+		if (conn == FAIL_COND) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			ret = errno;
+			break;
+		}
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(listener);
+			session_run(conn, handler);
+		} else if (pid == FAIL_COND) {
+			ERROR(errno, "Unable to fork a session");
+		}
+		close(conn);
+	}
+	close(listener);
+	return ret;
+}
+
+LINKAGE_PUBLIC int server_connect(const char* socketPath) {
+	struct sockaddr_un address;
+	int err;
+	if ((err = socket_address(socketPath, &address))) {
+		errno = err;
+		return FAIL_COND;
+	}
+	int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (conn == FAIL_COND) {
+		return FAIL_COND;
+	}
+	if (connect(conn, (struct sockaddr*) &address, sizeof(address))) {
+		err = errno;
+		close(conn);
+		errno = err;
+		return FAIL_COND;
+	}
+	return conn;
+}
+
+LINKAGE_PUBLIC int server_request(int socket, const char* line, int* status) {
+	size_t length = strlen(line);
+	if (length > SERVER_LINE_MAX) {
+		return E2BIG;
+	}
+	ServerFrame frame = { SERVER_FRAME_LINE, (uint32_t) length };
+	int fds[STDIO_COUNT] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	StdioControl control = { 0 };
+	struct iovec iov[2] = {
+		{ &frame, sizeof(frame) },
+		{ (void*) line, length }
+	};
+	struct msghdr message = {
+		.msg_iov = iov,
+		.msg_iovlen = 2,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer)
+	};
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(header), fds, sizeof(fds));
+	int ret;
+	ssize_t count;
+	while ((count = sendmsg(socket, &message, MSG_NOSIGNAL)) == FAIL_COND && errno == EINTR);
+	if (count == FAIL_COND) {
+		return errno;
+	}
+	// Only the descriptors have to go with the first byte, the rest may follow on its own
+	size_t total = sizeof(frame) + length;
+	if ((size_t) count < sizeof(frame)) {
+		transparent_return(write_full(socket, (char*) &frame + count, sizeof(frame) - count));
+		count = sizeof(frame);
+	}
+	transparent_return(write_full(socket, line + (count - sizeof(frame)), total - count));
+	struct {
+		ServerFrame frame;
+		int32_t status;
+	} reply;
+	transparent_return(read_full(socket, &reply, sizeof(reply)));
+	if (reply.frame.type != SERVER_FRAME_STATUS || reply.frame.length != sizeof(int32_t)) {
+		return EPROTO;
+	}
+	*status = reply.status;
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef ANUBIS_SERVER_H
+#define ANUBIS_SERVER_H
+
+#include <stdint.h>
+
+/* Command execution over a Unix domain socket (anubis -S socket). Every
+ * connection is served by a session forked from the listening shell, so each
+ * client has its own cwd, path and jobs while inheriting the primed path
+ * cache. A client sends framed command lines, each carrying its stdin,
+ * stdout and stderr as SCM_RIGHTS descriptors: the line runs with those
+ * installed, so output reaches the client directly, and the session answers
+ * with the line's exit status. Closing the connection ends the session.
+ * The socket is only accessible to its owner, and sessions from peers of
+ * another user are refused before anything is executed.
+ */
+
+#define SERVER_LINE_MAX (1 << 20)
+
+typedef enum ServerFrameType {
+	// Command line, with the client's stdio attached
+	SERVER_FRAME_LINE = 1,
+	// int32_t exit status of the line
+	SERVER_FRAME_STATUS = 2
+} ServerFrameType;
+
+typedef struct ServerFrame {
+	uint32_t type;
+	// Bytes of payload following the header
+	uint32_t length;
+} ServerFrame;
+
+// Executes a NUL terminated command line, returning its exit status
+typedef int (*ServerHandler)(char* line);
+
+// Serves connections until the listener fails, only returns on error (errno)
+int server_run(const char* socketPath, ServerHandler handler);
+
+// -1: Unable to connect (errno is set), Otherwise: connected socket
+int server_connect(const char* socketPath);
+/* Runs line on the server with this process's stdio.
+ * 0: status holds the exit status, EPIPE: the session ended (e.g. exit), Otherwise: errno
+ */
+int server_request(int socket, const char* line, int* status);
+
+#endif // ANUBIS_SERVER_H
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+
+#include "spawn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+
+#include "error.h"
+#include "checks.h"
+#include "options.h"
+#include "self_pipe.h"
+#include "zygote.h"
+#include "visibility.h"
+
+#define READ_PORT 0
+#define WRITE_PORT 1
+#define FAIL_COND -1
+
+extern char** environ;
+
+__attribute__((hot, noreturn))
+LINKAGE_PRIVATE void exec_child(char* resolved, Args args, IO* io, int selfPipe[2]) {
+	if (close(selfPipe[READ_PORT])) {
+		self_pipe_send(selfPipe, errno);
+		_exit(1);
+	}
+	// Plan descriptors are close-on-exec, so only the installed copies survive
+	if ((io->in != STDIN_FILENO && dup2(io->in, STDIN_FILENO) == FAIL_COND)
+		|| (io->out != STDOUT_FILENO && dup2(io->out, STDOUT_FILENO) == FAIL_COND)) {
+		self_pipe_send(selfPipe, errno);
+		_exit(1);
+	}
+	execv(resolved, args);
+	self_pipe_send(selfPipe, errno);
+	_exit(1);
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE int spawn_fork(char* resolved, Args args, IO* io, pid_t* pid) {
+	int selfPipe[2];
+	int ret;
+	ret_return(self_pipe_new(selfPipe), != 0, "Unable to create selfPipe");
+	if ((*pid = fork()) == 0) {
+		// Create child process
+		exec_child(resolved, args, io, selfPipe);
+	} else if (*pid == FAIL_COND) {
+		ret = errno;
+		close(selfPipe[READ_PORT]);
+		close(selfPipe[WRITE_PORT]);
+		return ret;
+	}
+	int err = 0;
+	// Await error byte or close-on-exec
+	if (self_pipe_poll(selfPipe, &err) <= 0) {
+		err = 0;
+	}
+	if (self_pipe_free(selfPipe)) {
+		ERROR(errno, "Unable to close self pipe read port");
+	}
+	return err;
+}
+
+__attribute__((hot))
+LINKAGE_PRIVATE int spawn_posix(char* resolved, Args args, IO* io, pid_t* pid) {
+	posix_spawn_file_actions_t actions;
+	int ret;
+	transparent_return(posix_spawn_file_actions_init(&actions));
+	if ((io->in != STDIN_FILENO && (ret = posix_spawn_file_actions_adddup2(&actions, io->in, STDIN_FILENO)))
+		|| (io->out != STDOUT_FILENO && (ret = posix_spawn_file_actions_adddup2(&actions, io->out, STDOUT_FILENO)))) {
+		posix_spawn_file_actions_destroy(&actions);
+		return ret;
+	}
+	// glibc launches via clone(CLONE_VM | CLONE_VFORK) and reports exec failures as the return value
+	ret = posix_spawn(pid, resolved, &actions, NULL, args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	return ret;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int spawn_command(char* resolved, Args args, IO* io, pid_t* pid) {
+	int ret;
+	switch (options.spawnEngine) {
+		case SPAWN_ENGINE_FORK: return spawn_fork(resolved, args, io, pid);
+		case SPAWN_ENGINE_ZYGOTE:
+			if ((ret = zygote_spawn(resolved, args, io, pid)) != ENOTCONN) {
+				return ret;
+			}
+			// No zygote to ask, launch it directly
+		default: return spawn_posix(resolved, args, io, pid);
+	}
+}
+
+LINKAGE_PUBLIC int spawn_direct(char* resolved, Args args, IO* io, pid_t* pid) {
+	return options.spawnEngine == SPAWN_ENGINE_FORK
+		? spawn_fork(resolved, args, io, pid)
+		: spawn_posix(resolved, args, io, pid);
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int spawn_task(SpawnTask task, void* context, IO* io, int closeFd, pid_t* pid) {
+	if ((*pid = fork()) == FAIL_COND) {
+		return errno;
+	} else if (*pid == 0) {
+		// Holding the read end would keep writes from ever seeing EPIPE
+		if (closeFd != FAIL_COND) {
+			close(closeFd);
+		}
+		// Skip atexit handlers and stdio buffers, those belong to the shell
+		_exit(task(context, io));
+	}
+	return 0;
+}
+
+LINKAGE_PUBLIC int spawn_replace(char* resolved, Args args) {
+	// Nothing runs after a successful exec, so output still buffered would be lost
+	fflush(NULL);
+	execv(resolved, args);
+	return errno;
+}
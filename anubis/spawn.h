@@ -0,0 +1,31 @@
+#ifndef ANUBIS_SPAWN_H
+#define ANUBIS_SPAWN_H
+
+#include <sys/types.h>
+
+#include "structure.h"
+
+// Descriptors a command is launched with, anything other than STDIN/STDOUT is installed in the child only
+typedef struct IO {
+	int in;
+	int out;
+} IO;
+
+// 0: Launched and exec succeeded, Otherwise: errno of the failed launch or exec
+int spawn_command(char* resolved, Args args, IO* io, pid_t* pid);
+/* As spawn_command(...) but never through the zygote, which only passes on io,
+ * for a command that is to inherit other descriptors not marked close-on-exec
+ */
+int spawn_direct(char* resolved, Args args, IO* io, pid_t* pid);
+
+/* Replaces the shell with the command, in its current stdio and cwd. Background
+ * jobs become the command's children. Only returns on failure, with the errno of the exec
+ */
+int spawn_replace(char* resolved, Args args);
+
+// Work run in a forked child without an exec, its return value is the exit status
+typedef int (*SpawnTask)(void* context, IO* io);
+// The child uses the descriptors as given and closes closeFd (if not -1), the parent's copy of its output pipe
+int spawn_task(SpawnTask task, void* context, IO* io, int closeFd, pid_t* pid);
+
+#endif // ANUBIS_SPAWN_H
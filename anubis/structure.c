@@ -1,75 +1,104 @@
 #include "structure.h"
 
+#include <stdio.h>
+
 #include "checks.h"
-#include "mem_utils.h"
 #include "visibility.h"
 
-LINKAGE_PUBLIC Command* command_new(char* command, Args args, size_t argCount) {
-	Command* cmd = malloc(sizeof(*cmd));
+LINKAGE_PUBLIC Command* command_new(Arena* arena, char* command, Args args, size_t argCount, Substitution* substitutions, size_t substitutionCount) {
+	Command* cmd = arena_alloc(arena, sizeof(*cmd));
 	INSTANCE_NULL_CHECK_RETURN("command", cmd, NULL);
 	cmd->command = command;
 	cmd->args = args;
 	cmd->argCount = argCount;
+	cmd->substitutions = substitutions;
+	cmd->substitutionCount = substitutionCount;
 	return cmd;
 }
 
-LINKAGE_PUBLIC void command_free(Command* command) {
-	INSTANCE_NULL_CHECK("command", command);
-	checked_free(command->command);
-	checked_array_free(command->args, command->argCount - 1, checked_free);
-	checked_free(command->args);
-	checked_free(command);
-}
-
-LINKAGE_PUBLIC IoModifiers* io_modifiers_new(char* outTrunc) {
-	IoModifiers* modifiers = malloc(sizeof(*modifiers));
+LINKAGE_PUBLIC IoModifiers* io_modifiers_new(Arena* arena, char* outTrunc) {
+	IoModifiers* modifiers = arena_alloc(arena, sizeof(*modifiers));
 	INSTANCE_NULL_CHECK_RETURN("IoModifiers", modifiers, NULL);
 	modifiers->outTrunc = outTrunc;
 	return modifiers;
 }
 
-LINKAGE_PUBLIC void io_modifiers_free(IoModifiers* modifiers) {
-	INSTANCE_NULL_CHECK("IoModifiers", modifiers);
-	checked_free(modifiers->outTrunc);
-	checked_free(modifiers);
-}
-
-LINKAGE_PUBLIC CommandLine* command_line_new(PipeList pipes, size_t pipeCount, IoModifiers* ioModifiers, BackgroundOp bgOp) {
-	CommandLine* cmdLine = malloc(sizeof(*cmdLine));
+LINKAGE_PUBLIC CommandLine* command_line_new(Arena* arena, PipeList pipes, size_t pipeCount, PipeList branches, size_t branchCount, IoModifiers* ioModifiers, BackgroundOp bgOp, bool timed) {
+	CommandLine* cmdLine = arena_alloc(arena, sizeof(*cmdLine));
 	INSTANCE_NULL_CHECK_RETURN("CommandLine", cmdLine, NULL);
 	cmdLine->pipes = pipes;
 	cmdLine->pipeCount = pipeCount;
+	cmdLine->branches = branches;
+	cmdLine->branchCount = branchCount;
 	cmdLine->ioModifiers = ioModifiers;
 	cmdLine->bgOp = bgOp;
+	cmdLine->timed = timed;
 	return cmdLine;
 }
 
-LINKAGE_PUBLIC void command_line_free(CommandLine* line) {
-	INSTANCE_NULL_CHECK("CommandLine", line);
-	checked_array_free(line->pipes, line->pipeCount, command_free);
-	checked_free(line->pipes);
-	io_modifiers_free(line->ioModifiers);
-	checked_free(line);
+LINKAGE_PUBLIC Command* command_line_stage(CommandLine* line, size_t stage) {
+	if (stage < line->pipeCount) {
+		return line->pipes[stage];
+	}
+	stage -= line->pipeCount;
+	return stage < line->branchCount ? line->branches[stage] : NULL;
 }
 
-LINKAGE_PUBLIC CommandTable* command_table_new() {
-	CommandTable* table = malloc(sizeof(*table));
+LINKAGE_PUBLIC void command_print(FILE* stream, Command* command) {
+	fprintf(stream, "%s", command->command);
+	for (size_t i = 1, next = 0; command->args[i] != NULL; i++) {
+		Substitution* substitution = next < command->substitutionCount && command->substitutions[next].argIndex == i
+			? &command->substitutions[next++]
+			: NULL;
+		fprintf(stream, " %s", command->args[i]);
+		for (size_t j = 0; substitution != NULL && j < substitution->pipeCount; j++) {
+			fprintf(stream, "%s", j == 0 ? "" : " | ");
+			command_print(stream, substitution->pipes[j]);
+		}
+		if (substitution != NULL) {
+			fprintf(stream, ")");
+		}
+	}
+}
+
+LINKAGE_PUBLIC char* command_line_describe(CommandLine* line) {
+	INSTANCE_NULL_CHECK_RETURN("CommandLine", line, NULL);
+	char* description = NULL;
+	size_t size = 0;
+	FILE* stream = open_memstream(&description, &size);
+	INSTANCE_NULL_CHECK_RETURN("description stream", stream, NULL);
+	if (line->timed) {
+		fprintf(stream, "time%s", line->pipeCount > 0 ? " " : "");
+	}
+	for (size_t i = 0; i < line->pipeCount; i++) {
+		fprintf(stream, "%s", i == 0 ? "" : " | ");
+		command_print(stream, line->pipes[i]);
+	}
+	for (size_t i = 0; i < line->branchCount; i++) {
+		fprintf(stream, "%s", i == 0 ? " |& { " : " , ");
+		command_print(stream, line->branches[i]);
+	}
+	if (line->branchCount > 0) {
+		fprintf(stream, " }");
+	}
+	if (line->ioModifiers != NULL && line->ioModifiers->outTrunc != NULL) {
+		fprintf(stream, " > %s", line->ioModifiers->outTrunc);
+	}
+	if (line->bgOp) {
+		fprintf(stream, " &");
+	}
+	fclose(stream);
+	return description;
+}
+
+LINKAGE_PUBLIC CommandTable* command_table_new(Arena* arena) {
+	CommandTable* table = arena_alloc(arena, sizeof(*table));
 	INSTANCE_NULL_CHECK_RETURN("CommandTable", table, NULL);
 	table->lineCount = 0;
 	table->lines = NULL;
 	return table;
 }
 
-LINKAGE_PUBLIC void command_table_free(CommandTable* table) {
-	if (table == NULL) {
-		// Invoked in shutdown hook, ignore null entries as they are already free
-		return;
-	}
-	checked_array_free(table->lines, table->lineCount, command_line_free);
-	checked_free(table->lines);
-	checked_free(table);
-}
-
 LINKAGE_PUBLIC void command_table_dump(CommandTable* table) {
 	INSTANCE_NULL_CHECK("CommandTable", table);
 	for (int i = 0; i < table->lineCount; i++) {
@@ -82,11 +111,20 @@ LINKAGE_PUBLIC void command_table_dump(CommandTable* table) {
 			}
 			fprintf(stderr, "]\n");
 		}
+		for (int j = 0; j < line->branchCount; j++) {
+			Command* branch = line->branches[j];
+			fprintf(stderr, "   [|&] %s [", branch->command);
+			for (int k = 0; k < branch->argCount; k++) {
+				fprintf(stderr, "%s%s", branch->args[k], k == branch->argCount - 1 ? "" : ",");
+			}
+			fprintf(stderr, "]\n");
+		}
 		if (line->ioModifiers != NULL) {
 			if (line->ioModifiers->outTrunc != NULL) {
 				fprintf(stderr, "   [>] %s\n", line->ioModifiers->outTrunc);
 			}
 		}
 		fprintf(stderr, "   [&] %s\n", line->bgOp ? "true" : "false");
+		fprintf(stderr, "   [time] %s\n", line->timed ? "true" : "false");
 	}
 }
@@ -3,17 +3,39 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
 
 typedef char** Args;
 
+struct Command;
+
+// A <(...) or >(...) argument, given to the command as a /dev/fd path of a pipe from or to its pipeline
+typedef struct Substitution {
+	// Index within the command's args, holding <( or >( as written
+	size_t argIndex;
+	// true: >(...), the pipeline reads what the command writes to the path
+	bool output;
+	size_t pipeCount;
+	struct Command** pipes;
+} Substitution;
+
 typedef struct __attribute__((__packed__)) Command {
 	size_t argCount;
 	char* command;
 	Args args;
+	// NULL without any process substitutions
+	size_t substitutionCount;
+	Substitution* substitutions;
 } Command;
 
-Command* command_new(char* command, Args args, size_t argCount);
-void command_free(Command* command);
+// All structures are allocated from, and released with, the arena owning the CommandTable
+
+Command* command_new(Arena* arena, char* command, Args args, size_t argCount, Substitution* substitutions, size_t substitutionCount);
+// The command and its arguments as written, substitutions included
+void command_print(FILE* stream, Command* command);
 
 typedef Command** PipeList;
 
@@ -22,8 +44,7 @@ typedef struct IoModifiers {
 	char* outTrunc; // NOTE: Add support for other IO operators here (e.g. >>, <, etc)
 } IoModifiers;
 
-IoModifiers* io_modifiers_new(char* outTrunc);
-void io_modifiers_free(IoModifiers* modifiers);
+IoModifiers* io_modifiers_new(Arena* arena, char* outTrunc);
 
 typedef bool BackgroundOp;
 
@@ -32,18 +53,29 @@ typedef struct __attribute__((__packed__)) CommandLine {
 	PipeList pipes;
 	IoModifiers* ioModifiers;
 	BackgroundOp bgOp;
+	// Prefixed with the time keyword, resources are reported once it completes
+	bool timed;
+	// Each fed a copy of the pipeline's output (|& { a , b }), NULL without a fan-out
+	size_t branchCount;
+	PipeList branches;
 } CommandLine;
 
-CommandLine* command_line_new(PipeList pipes, size_t pipeCount, IoModifiers* ioModifiers, BackgroundOp bgOp);
-void command_line_free(CommandLine* line);
+CommandLine* command_line_new(Arena* arena, PipeList pipes, size_t pipeCount, PipeList branches, size_t branchCount, IoModifiers* ioModifiers, BackgroundOp bgOp, bool timed);
+/* Command run as the given stage of the line's job: the pipes, then the branches.
+ * NULL: The stage after the last branch, the relay feeding them
+ */
+Command* command_line_stage(CommandLine* line, size_t stage);
+// Stage of the processes of a command's process substitutions, there is no command for it
+#define STAGE_SUBSTITUTION SIZE_MAX
+// Heap allocated (not arena) textual form of the line, for descriptions that outlive it
+char* command_line_describe(CommandLine* line);
 
 typedef struct CommandTable {
 	size_t lineCount;
 	CommandLine** lines;
 } CommandTable;
 
-CommandTable* command_table_new();
-void command_table_free(CommandTable* table);
+CommandTable* command_table_new(Arena* arena);
 
 void command_table_dump(CommandTable* table);
 
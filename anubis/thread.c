@@ -0,0 +1,15 @@
+#include "thread.h"
+
+#include <signal.h>
+
+#include "visibility.h"
+
+LINKAGE_PUBLIC int thread_start(pthread_t* thread, void* (*main)(void*), void* argument) {
+	// The new thread inherits the mask in place while it is created
+	sigset_t all, previous;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &previous);
+	int err = pthread_create(thread, NULL, main, argument);
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	return err;
+}
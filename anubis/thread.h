@@ -0,0 +1,13 @@
+#ifndef ANUBIS_THREAD_H
+#define ANUBIS_THREAD_H
+
+#include <pthread.h>
+
+/* Helper threads started with every signal blocked, so signals (SIGCHLD in
+ * particular) stay with the thread running commands.
+ */
+
+// 0: Started, Otherwise: the pthread_create error
+int thread_start(pthread_t* thread, void* (*main)(void*), void* argument);
+
+#endif // ANUBIS_THREAD_H
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "error.h"
+#include "visibility.h"
+
+// Bucket i holds latencies in [2^i, 2^(i+1)) nanoseconds
+#define TRACE_BUCKETS 64
+// Events are buffered and written in batches to keep memory bounded
+#define TRACE_EVENT_BUFFER 4096
+#define NANOS_PER_MICRO 1000.0
+
+const char* trace_phase_names[] = {
+	[TRACE_READ] = "read",
+	[TRACE_LEX] = "lex",
+	[TRACE_PARSE] = "parse",
+	[TRACE_RESOLVE] = "resolve",
+	[TRACE_SPAWN] = "spawn",
+	[TRACE_BUILTIN] = "builtin",
+	[TRACE_UTILITY] = "utility",
+	[TRACE_WAIT] = "wait"
+};
+
+typedef struct TraceHistogram {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[TRACE_BUCKETS];
+} TraceHistogram;
+
+typedef struct TraceEvent {
+	TracePhase phase;
+	uint64_t start;
+	uint64_t duration;
+	pid_t tid;
+} TraceEvent;
+
+bool trace_enabled = false;
+
+static TraceHistogram histograms[TRACE_PHASE_COUNT];
+static FILE* traceFile = NULL;
+static TraceEvent events[TRACE_EVENT_BUFFER];
+static size_t eventCount = 0;
+static bool eventsWritten = false;
+static uint64_t epoch = 0;
+// Batch scripts may be parsed ahead on a second thread
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+LINKAGE_PUBLIC uint64_t trace_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+LINKAGE_PUBLIC int trace_init(const char* file) {
+	trace_enabled = true;
+	for (size_t i = 0; i < TRACE_PHASE_COUNT; i++) {
+		histograms[i].min = UINT64_MAX;
+	}
+	epoch = trace_now();
+	if (file != NULL) {
+		if ((traceFile = fopen(file, "we")) == NULL) {
+			int err = errno;
+			ERROR(err, "Unable to open trace file %s", file);
+			trace_enabled = false;
+			return err;
+		}
+		fprintf(traceFile, "{\"traceEvents\":[\n");
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE void flush_events() {
+	pid_t pid = getpid();
+	for (size_t i = 0; i < eventCount; i++) {
+		TraceEvent* event = &events[i];
+		fprintf(
+			traceFile,
+			"%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+			eventsWritten ? ",\n" : "",
+			trace_phase_names[event->phase],
+			(event->start - epoch) / NANOS_PER_MICRO,
+			event->duration / NANOS_PER_MICRO,
+			pid,
+			event->tid
+		);
+		eventsWritten = true;
+	}
+	eventCount = 0;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC void trace_record(TracePhase phase, uint64_t start) {
+	uint64_t duration = trace_now() - start;
+	pthread_mutex_lock(&traceLock);
+	TraceHistogram* histogram = &histograms[phase];
+	histogram->count++;
+	histogram->total += duration;
+	histogram->min = duration < histogram->min ? duration : histogram->min;
+	histogram->max = duration > histogram->max ? duration : histogram->max;
+	histogram->buckets[duration == 0 ? 0 : 63 - __builtin_clzll(duration)]++;
+	if (traceFile != NULL && phase != TRACE_LEX) {
+		events[eventCount++] = (TraceEvent) { phase, start, duration, gettid() };
+		if (eventCount == TRACE_EVENT_BUFFER) {
+			flush_events();
+		}
+	}
+	pthread_mutex_unlock(&traceLock);
+}
+
+LINKAGE_PRIVATE void print_histogram(TracePhase phase, TraceHistogram* histogram) {
+	fprintf(
+		stderr,
+		"%-8s %10lu %14.3f %10.3f %10.3f %10.3f\n",
+		trace_phase_names[phase],
+		(unsigned long) histogram->count,
+		histogram->total / NANOS_PER_MICRO,
+		histogram->total / NANOS_PER_MICRO / histogram->count,
+		histogram->min / NANOS_PER_MICRO,
+		histogram->max / NANOS_PER_MICRO
+	);
+	for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+		if (histogram->buckets[i] > 0) {
+			fprintf(stderr, "    < %-12lu ns %10lu\n", 2UL << i, (unsigned long) histogram->buckets[i]);
+		}
+	}
+}
+
+LINKAGE_PUBLIC void trace_dump() {
+	if (!trace_enabled) {
+		return;
+	}
+	pthread_mutex_lock(&traceLock);
+	trace_enabled = false;
+	fprintf(stderr, "%-8s %10s %14s %10s %10s %10s\n", "phase", "count", "total us", "mean us", "min us", "max us");
+	for (TracePhase phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+		if (histograms[phase].count > 0) {
+			print_histogram(phase, &histograms[phase]);
+		}
+	}
+	if (traceFile != NULL) {
+		flush_events();
+		fprintf(traceFile, "\n],\"displayTimeUnit\":\"ns\"}\n");
+		fclose(traceFile);
+		traceFile = NULL;
+	}
+	pthread_mutex_unlock(&traceLock);
+}
@@ -0,0 +1,45 @@
+#ifndef ANUBIS_TRACE_H
+#define ANUBIS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Phase tracing of the shell's own work. Disabled it costs a branch per
+ * phase, enabled each phase is timed with CLOCK_MONOTONIC into a log2 latency
+ * histogram (printed at exit) and optionally streamed as Chrome trace events
+ * (chrome://tracing, Perfetto). Configured by options, see options.h.
+ */
+
+typedef enum TracePhase {
+	TRACE_READ,
+	// Per token, not emitted as trace events (parse spans include it)
+	TRACE_LEX,
+	TRACE_PARSE,
+	TRACE_RESOLVE,
+	TRACE_SPAWN,
+	TRACE_BUILTIN,
+	TRACE_UTILITY,
+	TRACE_WAIT,
+	TRACE_PHASE_COUNT
+} TracePhase;
+
+extern const char* trace_phase_names[];
+extern bool trace_enabled;
+
+// 0: Tracing disabled, Otherwise: current CLOCK_MONOTONIC time in nanoseconds
+#define TRACE_BEGIN() (__builtin_expect(trace_enabled, 0) ? trace_now() : 0)
+#define TRACE_END(phase, start)\
+	do {\
+		if (__builtin_expect(trace_enabled, 0)) {\
+			trace_record((phase), (start));\
+		}\
+	} while (0)
+
+// Enables tracing, file (if not NULL) receives the Chrome trace JSON
+int trace_init(const char* file);
+uint64_t trace_now();
+void trace_record(TracePhase phase, uint64_t start);
+// Prints the histograms and completes the trace file, tracing stops afterwards
+void trace_dump();
+
+#endif // ANUBIS_TRACE_H
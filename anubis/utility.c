@@ -0,0 +1,666 @@
+#define _GNU_SOURCE
+
+#include "utility.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "relay.h"
+#include "visibility.h"
+
+#define WRITER_BUFFER_SIZE 8192
+#define COPY_BUFFER_SIZE 65536
+#define STDIN_OPERAND "-"
+#define MAX_CONVERSION_SPEC 64
+// Widest padding wc uses when a count's size can't be known up front
+#define WC_UNKNOWN_WIDTH 7
+
+typedef struct Writer {
+	int fd;
+	size_t len;
+	bool failed;
+	char buffer[WRITER_BUFFER_SIZE];
+} Writer;
+
+LINKAGE_PRIVATE bool accepts_all(char** args, size_t argCount);
+LINKAGE_PRIVATE bool accepts_operands(char** args, size_t argCount);
+LINKAGE_PRIVATE bool accepts_wc(char** args, size_t argCount);
+
+// NOTE: This is in alphabetical order to allow for binary search over utilities
+Utility utilities[] = {
+	{"cat", utility_cat, accepts_operands, true},
+	{"echo", utility_echo, accepts_all, true},
+	{"false", utility_false, accepts_all, true},
+	{"printf", utility_printf, accepts_all, true},
+	{"true", utility_true, accepts_all, true},
+	{"wc", utility_wc, accepts_wc, true},
+	{NULL, NULL, NULL, false}
+};
+
+size_t utilities_size = sizeof(utilities) / sizeof(*utilities) - 1;
+
+// Where the executables the utilities stand in for are installed
+static const char* systemDirectories[] = { "/bin/", "/usr/bin/" };
+
+LINKAGE_PRIVATE int write_all(int fd, const char* data, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno;
+		}
+		data += written;
+		len -= written;
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE void writer_flush(Writer* writer) {
+	if (!writer->failed && writer->len > 0 && write_all(writer->fd, writer->buffer, writer->len)) {
+		writer->failed = true;
+	}
+	writer->len = 0;
+}
+
+LINKAGE_PRIVATE void writer_write(Writer* writer, const char* data, size_t len) {
+	if (writer->len + len > WRITER_BUFFER_SIZE) {
+		writer_flush(writer);
+		if (len > WRITER_BUFFER_SIZE) {
+			writer->failed |= write_all(writer->fd, data, len) != 0;
+			return;
+		}
+	}
+	memcpy(&writer->buffer[writer->len], data, len);
+	writer->len += len;
+}
+
+LINKAGE_TRANSPARENT void writer_putc(Writer* writer, char c) {
+	writer_write(writer, &c, 1);
+}
+
+LINKAGE_TRANSPARENT void writer_puts(Writer* writer, const char* str) {
+	writer_write(writer, str, strlen(str));
+}
+
+// Exit status of a utility once its output is complete
+LINKAGE_PRIVATE int writer_finish(Writer* writer) {
+	writer_flush(writer);
+	return writer->failed;
+}
+
+LINKAGE_PRIVATE void report(const char* utility, const char* subject, int err) {
+	dprintf(STDERR_FILENO, "%s: %s: %s\n", utility, subject, strerror(err));
+}
+
+// -1: Not an operand, Otherwise: descriptor to read, opened if a file
+LINKAGE_PRIVATE int open_operand(const char* utility, char* operand, int in) {
+	if (strcmp(operand, STDIN_OPERAND) == 0) {
+		return in;
+	}
+	int fd = open(operand, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		report(utility, operand, errno);
+	}
+	return fd;
+}
+
+LINKAGE_PRIVATE bool is_help_or_version(char* arg) {
+	return strcmp(arg, "--help") == 0 || strcmp(arg, "--version") == 0;
+}
+
+LINKAGE_PRIVATE bool accepts_all(char** args, size_t argCount) {
+	// Only a lone --help/--version is treated as an option by these utilities
+	return argCount != 1 || !is_help_or_version(args[0]);
+}
+
+LINKAGE_PRIVATE bool accepts_operands(char** args, size_t argCount) {
+	for (size_t i = 0; i < argCount; i++) {
+		if (args[i][0] == '-' && args[i][1] != '\0') {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Escape sequence handling shared by echo -e, printf formats and printf %b
+// Returns the number of characters consumed after the backslash
+LINKAGE_PRIVATE size_t write_escape(Writer* writer, const char* sequence, bool zeroOctal, bool* stop) {
+	char c = sequence[0];
+	size_t consumed = 1;
+	unsigned int value = 0;
+	switch (c) {
+		case 'a': writer_putc(writer, '\a'); break;
+		case 'b': writer_putc(writer, '\b'); break;
+		case 'e': writer_putc(writer, '\033'); break;
+		case 'f': writer_putc(writer, '\f'); break;
+		case 'n': writer_putc(writer, '\n'); break;
+		case 'r': writer_putc(writer, '\r'); break;
+		case 't': writer_putc(writer, '\t'); break;
+		case 'v': writer_putc(writer, '\v'); break;
+		case '\\': writer_putc(writer, '\\'); break;
+		case 'c':
+			*stop = true;
+			break;
+		case 'x':
+			if (!isxdigit((unsigned char) sequence[1])) {
+				writer_write(writer, "\\x", 2);
+				break;
+			}
+			for (; consumed < 3 && isxdigit((unsigned char) sequence[consumed]); consumed++) {
+				char h = sequence[consumed];
+				value = value * 16 + (isdigit((unsigned char) h) ? h - '0' : (tolower((unsigned char) h) - 'a' + 10));
+			}
+			writer_putc(writer, (char) value);
+			break;
+		case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7':
+			if (zeroOctal && c != '0') {
+				// Only \0NNN is octal for echo and %b
+				writer_putc(writer, '\\');
+				consumed = 0;
+				break;
+			}
+			consumed = zeroOctal ? 1 : 0;
+			size_t limit = consumed + 3;
+			for (; consumed < limit && sequence[consumed] >= '0' && sequence[consumed] <= '7'; consumed++) {
+				value = value * 8 + (sequence[consumed] - '0');
+			}
+			writer_putc(writer, (char) value);
+			break;
+		case '\0':
+			writer_putc(writer, '\\');
+			consumed = 0;
+			break;
+		default:
+			writer_putc(writer, '\\');
+			writer_putc(writer, c);
+			break;
+	}
+	return consumed;
+}
+
+// Returns true if output should stop (\c)
+LINKAGE_PRIVATE bool write_escaped(Writer* writer, const char* str, bool zeroOctal) {
+	bool stop = false;
+	for (const char* c = str; *c != '\0' && !stop; c++) {
+		if (*c != '\\') {
+			writer_putc(writer, *c);
+			continue;
+		}
+		c += write_escape(writer, c + 1, zeroOctal, &stop);
+	}
+	return stop;
+}
+
+LINKAGE_PUBLIC int utility_true(int in, int out, char** args, size_t argCount) {
+	return 0;
+}
+
+LINKAGE_PUBLIC int utility_false(int in, int out, char** args, size_t argCount) {
+	return 1;
+}
+
+LINKAGE_PRIVATE bool is_echo_option(char* arg) {
+	if (arg[0] != '-' || arg[1] == '\0') {
+		return false;
+	}
+	return strspn(&arg[1], "neE") == strlen(&arg[1]);
+}
+
+LINKAGE_PUBLIC int utility_echo(int in, int out, char** args, size_t argCount) {
+	Writer writer = { .fd = out };
+	bool newline = true;
+	bool escapes = false;
+	size_t i = 0;
+	for (; i < argCount && is_echo_option(args[i]); i++) {
+		for (char* flag = &args[i][1]; *flag != '\0'; flag++) {
+			newline &= *flag != 'n';
+			escapes = *flag == 'e' ? true : *flag == 'E' ? false : escapes;
+		}
+	}
+	for (size_t first = i; i < argCount; i++) {
+		if (i > first) {
+			writer_putc(&writer, ' ');
+		}
+		if (!escapes) {
+			writer_puts(&writer, args[i]);
+		} else if (write_escaped(&writer, args[i], true)) {
+			return writer_finish(&writer);
+		}
+	}
+	if (newline) {
+		writer_putc(&writer, '\n');
+	}
+	return writer_finish(&writer);
+}
+
+LINKAGE_PUBLIC int utility_cat(int in, int out, char** args, size_t argCount) {
+	static char* stdinOperand[] = { STDIN_OPERAND };
+	if (argCount == 0) {
+		args = stdinOperand;
+		argCount = 1;
+	}
+	int status = 0;
+	for (size_t i = 0; i < argCount; i++) {
+		int fd = open_operand("cat", args[i], in);
+		if (fd == -1) {
+			status = 1;
+			continue;
+		}
+		int err = relay_copy(fd, out);
+		if (fd != in) {
+			close(fd);
+		}
+		if (err) {
+			report("cat", args[i], err);
+			status = 1;
+		}
+	}
+	return status;
+}
+
+typedef struct WcCounts {
+	uintmax_t lines;
+	uintmax_t words;
+	uintmax_t bytes;
+} WcCounts;
+
+typedef struct WcSelection {
+	bool lines;
+	bool words;
+	bool bytes;
+} WcSelection;
+
+LINKAGE_PRIVATE bool parse_wc_options(char** args, size_t argCount, WcSelection* selection, size_t* operands) {
+	*selection = (WcSelection) { 0 };
+	size_t i = 0;
+	for (; i < argCount && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+		if (strcmp(args[i], "--") == 0) {
+			i++;
+			break;
+		}
+		for (char* flag = &args[i][1]; *flag != '\0'; flag++) {
+			switch (*flag) {
+				case 'l': selection->lines = true; break;
+				case 'w': selection->words = true; break;
+				case 'c': selection->bytes = true; break;
+				default: return false;
+			}
+		}
+	}
+	if (!selection->lines && !selection->words && !selection->bytes) {
+		*selection = (WcSelection) { true, true, true };
+	}
+	*operands = i;
+	return true;
+}
+
+LINKAGE_PRIVATE bool accepts_wc(char** args, size_t argCount) {
+	WcSelection selection;
+	size_t operands;
+	if (!parse_wc_options(args, argCount, &selection, &operands)) {
+		return false;
+	}
+	// Options after operands are permuted by the real wc, leave those to it
+	return accepts_operands(&args[operands], argCount - operands);
+}
+
+LINKAGE_PRIVATE int wc_count(int fd, WcCounts* counts) {
+	static char buffer[COPY_BUFFER_SIZE];
+	bool inWord = false;
+	ssize_t count;
+	*counts = (WcCounts) { 0 };
+	while ((count = read(fd, buffer, sizeof(buffer))) != 0) {
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno;
+		}
+		counts->bytes += count;
+		for (ssize_t i = 0; i < count; i++) {
+			char c = buffer[i];
+			bool space = c == ' ' || (c >= '\t' && c <= '\r');
+			counts->lines += c == '\n';
+			counts->words += !space && !inWord;
+			inWord = !space;
+		}
+	}
+	return 0;
+}
+
+LINKAGE_PRIVATE void wc_print(Writer* writer, WcCounts* counts, WcSelection* selection, int width, char* name) {
+	char field[32];
+	uintmax_t values[] = { counts->lines, counts->words, counts->bytes };
+	bool selected[] = { selection->lines, selection->words, selection->bytes };
+	bool first = true;
+	for (size_t i = 0; i < sizeof(values) / sizeof(*values); i++) {
+		if (!selected[i]) {
+			continue;
+		}
+		int len = snprintf(field, sizeof(field), "%s%*" PRIuMAX, first ? "" : " ", width, values[i]);
+		writer_write(writer, field, len);
+		first = false;
+	}
+	if (name != NULL) {
+		writer_putc(writer, ' ');
+		writer_puts(writer, name);
+	}
+	writer_putc(writer, '\n');
+}
+
+// Matches coreutils: pad to the digits of the total size of regular inputs, or 7 for anything else
+LINKAGE_PRIVATE int wc_width(int in, char** operands, size_t count, WcSelection* selection) {
+	size_t selected = selection->lines + selection->words + selection->bytes;
+	if (count <= 1 && selected == 1) {
+		return 1;
+	}
+	int width = 1;
+	int minimum = 1;
+	uintmax_t total = 0;
+	for (size_t i = 0; i < (count == 0 ? 1 : count); i++) {
+		struct stat sstat;
+		int ret = count == 0 || strcmp(operands[i], STDIN_OPERAND) == 0
+			? fstat(in, &sstat)
+			: stat(operands[i], &sstat);
+		if (ret != 0) {
+			continue;
+		} else if (!S_ISREG(sstat.st_mode)) {
+			minimum = WC_UNKNOWN_WIDTH;
+		} else {
+			total += sstat.st_size;
+		}
+	}
+	for (; total >= 10; total /= 10) {
+		width++;
+	}
+	return width < minimum ? minimum : width;
+}
+
+LINKAGE_PUBLIC int utility_wc(int in, int out, char** args, size_t argCount) {
+	WcSelection selection;
+	size_t first;
+	parse_wc_options(args, argCount, &selection, &first);
+	char** operands = &args[first];
+	size_t count = argCount - first;
+	int width = wc_width(in, operands, count, &selection);
+	Writer writer = { .fd = out };
+	WcCounts counts;
+	if (count == 0) {
+		int err = wc_count(in, &counts);
+		if (err) {
+			report("wc", STDIN_OPERAND, err);
+			return 1;
+		}
+		wc_print(&writer, &counts, &selection, width, NULL);
+		return writer_finish(&writer);
+	}
+	int status = 0;
+	WcCounts total = { 0 };
+	for (size_t i = 0; i < count; i++) {
+		int fd = open_operand("wc", operands[i], in);
+		if (fd == -1) {
+			status = 1;
+			continue;
+		}
+		int err = wc_count(fd, &counts);
+		if (fd != in) {
+			close(fd);
+		}
+		if (err) {
+			report("wc", operands[i], err);
+			status = 1;
+			continue;
+		}
+		wc_print(&writer, &counts, &selection, width, operands[i]);
+		total.lines += counts.lines;
+		total.words += counts.words;
+		total.bytes += counts.bytes;
+	}
+	if (count > 1) {
+		wc_print(&writer, &total, &selection, width, "total");
+	}
+	return writer_finish(&writer) || status;
+}
+
+typedef struct PrintfState {
+	char** args;
+	size_t argCount;
+	size_t next;
+	int status;
+} PrintfState;
+
+LINKAGE_PRIVATE char* printf_next_arg(PrintfState* state) {
+	return state->next < state->argCount ? state->args[state->next++] : NULL;
+}
+
+LINKAGE_PRIVATE void printf_numeric_error(PrintfState* state, char* arg, const char* end) {
+	if (*end != '\0' || errno == ERANGE) {
+		dprintf(STDERR_FILENO, "printf: '%s': %s\n", arg, errno == ERANGE ? strerror(ERANGE) : "expected a numeric value");
+		state->status = 1;
+	}
+}
+
+LINKAGE_PRIVATE intmax_t printf_signed(PrintfState* state) {
+	char* arg = printf_next_arg(state);
+	if (arg == NULL) {
+		return 0;
+	} else if (arg[0] == '\'' || arg[0] == '"') {
+		// Character constant, the value of the following character
+		return (unsigned char) arg[1];
+	}
+	char* end;
+	errno = 0;
+	intmax_t value = strtoimax(arg, &end, 0);
+	printf_numeric_error(state, arg, end);
+	return value;
+}
+
+LINKAGE_PRIVATE uintmax_t printf_unsigned(PrintfState* state) {
+	char* arg = printf_next_arg(state);
+	if (arg == NULL) {
+		return 0;
+	} else if (arg[0] == '\'' || arg[0] == '"') {
+		return (unsigned char) arg[1];
+	}
+	char* end;
+	errno = 0;
+	uintmax_t value = strtoumax(arg, &end, 0);
+	printf_numeric_error(state, arg, end);
+	return value;
+}
+
+LINKAGE_PRIVATE long double printf_float(PrintfState* state) {
+	char* arg = printf_next_arg(state);
+	if (arg == NULL) {
+		return 0;
+	} else if (arg[0] == '\'' || arg[0] == '"') {
+		return (unsigned char) arg[1];
+	}
+	char* end;
+	errno = 0;
+	long double value = strtold(arg, &end);
+	printf_numeric_error(state, arg, end);
+	return value;
+}
+
+// Emits one conversion, returns characters of the format consumed (after the %) or 0 if invalid
+LINKAGE_PRIVATE size_t printf_conversion(Writer* writer, const char* format, PrintfState* state, bool* stop) {
+	char spec[MAX_CONVERSION_SPEC] = "%";
+	size_t len = 1;
+	size_t i = 0;
+	int star[2];
+	int stars = 0;
+	// Flags, width and precision are copied through, * is taken from the arguments
+	while (format[i] != '\0' && strchr("-+ #0", format[i]) != NULL && len < MAX_CONVERSION_SPEC - 8) {
+		spec[len++] = format[i++];
+	}
+	for (int part = 0; part < 2; part++) {
+		if (part == 1) {
+			if (format[i] != '.') {
+				break;
+			}
+			spec[len++] = format[i++];
+		}
+		if (format[i] == '*') {
+			star[stars++] = (int) printf_signed(state);
+			spec[len++] = format[i++];
+			continue;
+		}
+		while (isdigit((unsigned char) format[i]) && len < MAX_CONVERSION_SPEC - 8) {
+			spec[len++] = format[i++];
+		}
+	}
+	char conversion = format[i];
+	char* output = NULL;
+	int count = -1;
+	spec[len] = '\0';
+	switch (conversion) {
+		case 'd': case 'i':
+			strcat(spec, "j");
+			spec[len + 1] = conversion;
+			spec[len + 2] = '\0';
+			intmax_t signedValue = printf_signed(state);
+			count = stars == 2 ? asprintf(&output, spec, star[0], star[1], signedValue)
+				: stars == 1 ? asprintf(&output, spec, star[0], signedValue)
+				: asprintf(&output, spec, signedValue);
+			break;
+		case 'o': case 'u': case 'x': case 'X':
+			strcat(spec, "j");
+			spec[len + 1] = conversion;
+			spec[len + 2] = '\0';
+			uintmax_t unsignedValue = printf_unsigned(state);
+			count = stars == 2 ? asprintf(&output, spec, star[0], star[1], unsignedValue)
+				: stars == 1 ? asprintf(&output, spec, star[0], unsignedValue)
+				: asprintf(&output, spec, unsignedValue);
+			break;
+		case 'a': case 'A': case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+			strcat(spec, "L");
+			spec[len + 1] = conversion;
+			spec[len + 2] = '\0';
+			long double floatValue = printf_float(state);
+			count = stars == 2 ? asprintf(&output, spec, star[0], star[1], floatValue)
+				: stars == 1 ? asprintf(&output, spec, star[0], floatValue)
+				: asprintf(&output, spec, floatValue);
+			break;
+		case 'c':
+		case 's':
+			spec[len] = 's';
+			spec[len + 1] = '\0';
+			char* arg = printf_next_arg(state);
+			char character[2] = { arg == NULL ? '\0' : arg[0], '\0' };
+			char* stringValue = conversion == 'c' ? character : arg == NULL ? "" : arg;
+			count = stars == 2 ? asprintf(&output, spec, star[0], star[1], stringValue)
+				: stars == 1 ? asprintf(&output, spec, star[0], stringValue)
+				: asprintf(&output, spec, stringValue);
+			break;
+		case 'b': {
+			char* escaped = printf_next_arg(state);
+			*stop = write_escaped(writer, escaped == NULL ? "" : escaped, true);
+			return i + 1;
+		}
+		default:
+			dprintf(STDERR_FILENO, "printf: %%%c: invalid conversion specification\n", conversion);
+			state->status = 1;
+			*stop = true;
+			return i + (conversion != '\0');
+	}
+	if (count >= 0) {
+		writer_write(writer, output, count);
+		free(output);
+	}
+	return i + 1;
+}
+
+LINKAGE_PUBLIC int utility_printf(int in, int out, char** args, size_t argCount) {
+	if (argCount == 0) {
+		dprintf(STDERR_FILENO, "printf: missing operand\n");
+		return 1;
+	}
+	char* format = args[0];
+	PrintfState state = { &args[1], argCount - 1, 0, 0 };
+	Writer writer = { .fd = out };
+	bool stop = false;
+	// The format is reused while arguments remain, provided it consumes any
+	do {
+		size_t consumedBefore = state.next;
+		for (const char* c = format; *c != '\0' && !stop; c++) {
+			if (*c == '\\') {
+				c += write_escape(&writer, c + 1, false, &stop);
+			} else if (*c == '%' && c[1] == '%') {
+				writer_putc(&writer, '%');
+				c++;
+			} else if (*c == '%') {
+				c += printf_conversion(&writer, c + 1, &state, &stop);
+			} else {
+				writer_putc(&writer, *c);
+			}
+		}
+		if (state.next == consumedBefore) {
+			break;
+		}
+	} while (state.next < state.argCount && !stop);
+	return writer_finish(&writer) || state.status;
+}
+
+LINKAGE_PRIVATE Utility* utility_find(char* command) {
+	int lower = 0;
+	int mid;
+	int upper = utilities_size - 1;
+	int ret;
+	while (lower <= upper) {
+		mid = (lower + upper) / 2;
+		Utility* utility = &utilities[mid];
+		ret = strcmp(utility->name, command);
+		if (ret == 0) {
+			return utility;
+		} else if (ret > 0) {
+			upper = mid - 1;
+		} else {
+			lower = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+// true: resolved is an executable directly in one of the system directories
+LINKAGE_PRIVATE bool utility_system(char* resolved) {
+	for (size_t i = 0; i < sizeof(systemDirectories) / sizeof(*systemDirectories); i++) {
+		size_t length = strlen(systemDirectories[i]);
+		if (strncmp(resolved, systemDirectories[i], length) == 0 && strchr(resolved + length, '/') == NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC Utility* utility_lookup(char* command, char* resolved, char** args, size_t argCount) {
+	if (!options.utilities || resolved == NULL) {
+		return NULL;
+	}
+	Utility* utility = utility_find(command);
+	if (utility == NULL || !utility->enabled || !utility_system(resolved) || !utility->accepts(args, argCount)) {
+		return NULL;
+	}
+	return utility;
+}
+
+LINKAGE_PUBLIC int utility_set_enabled(char* name, bool enabled) {
+	Utility* utility = utility_find(name);
+	if (utility == NULL) {
+		return ENOENT;
+	}
+	utility->enabled = enabled;
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef ANUBIS_UTILITY_H
+#define ANUBIS_UTILITY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* In-process implementations of common external utilities. Unlike builtins
+ * they behave exactly as the program they stand in for (exit status, output
+ * on the given descriptors) and so can run either inside the shell or in a
+ * forked child without an exec. Invocations using options an implementation
+ * does not understand are left to the real executable on the path, as are
+ * names the path does not resolve to the system's own executable (an empty
+ * path runs none of them, an echo of another directory runs as found).
+ */
+
+// Exit status style: 0 success, otherwise failure
+typedef int (*UtilityRun)(int in, int out, char** args, size_t argCount);
+// true: Invocation handled in-process, false: defer to the executable
+typedef bool (*UtilityAccepts)(char** args, size_t argCount);
+
+typedef struct Utility {
+	const char* name;
+	UtilityRun run;
+	UtilityAccepts accepts;
+	bool enabled;
+} Utility;
+
+extern Utility utilities[];
+extern size_t utilities_size;
+
+/* resolved: the executable the path finds for command, NULL if none
+ * NULL: No enabled utility that stands in for it and accepts these arguments, Otherwise: the utility to run
+ */
+Utility* utility_lookup(char* command, char* resolved, char** args, size_t argCount);
+// 0: Updated, ENOENT: No utility by that name
+int utility_set_enabled(char* name, bool enabled);
+
+int utility_cat(int in, int out, char** args, size_t argCount);
+int utility_echo(int in, int out, char** args, size_t argCount);
+int utility_false(int in, int out, char** args, size_t argCount);
+int utility_printf(int in, int out, char** args, size_t argCount);
+int utility_true(int in, int out, char** args, size_t argCount);
+int utility_wc(int in, int out, char** args, size_t argCount);
+
+#endif // ANUBIS_UTILITY_H
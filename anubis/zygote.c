@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include "zygote.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "checks.h"
+#include "self_pipe.h"
+#include "visibility.h"
+
+#define READ_PORT 0
+#define WRITE_PORT 1
+#define FAIL_COND -1
+#define SHELL_END 0
+#define ZYGOTE_END 1
+// stdin, stdout, stderr and the cwd, in that order
+#define REQUEST_FDS 4
+#define REQUEST_IN 0
+#define REQUEST_OUT 1
+#define REQUEST_ERR 2
+#define REQUEST_CWD 3
+
+// Followed by length bytes: the resolved path then each argument, NUL terminated
+typedef struct ZygoteRequest {
+	uint32_t argCount;
+	uint32_t length;
+} ZygoteRequest;
+
+typedef struct ZygoteReply {
+	// 0: Launched and exec succeeded, Otherwise: errno of the failed launch or exec
+	int32_t err;
+	int32_t pid;
+} ZygoteReply;
+
+typedef union RequestControl {
+	char buffer[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+	struct cmsghdr align;
+} RequestControl;
+
+static int zygoteFd = FAIL_COND;
+static pid_t zygotePid = FAIL_COND;
+
+__attribute__((noreturn))
+LINKAGE_PRIVATE void zygote_exec(char* resolved, char** argv, int fds[REQUEST_FDS], int selfPipe[2]) {
+	close(selfPipe[READ_PORT]);
+	// Received descriptors are close-on-exec, only the installed copies survive
+	if (fchdir(fds[REQUEST_CWD]) == FAIL_COND
+		|| dup2(fds[REQUEST_IN], STDIN_FILENO) == FAIL_COND
+		|| dup2(fds[REQUEST_OUT], STDOUT_FILENO) == FAIL_COND
+		|| dup2(fds[REQUEST_ERR], STDERR_FILENO) == FAIL_COND) {
+		self_pipe_send(selfPipe, errno);
+		_exit(1);
+	}
+	execv(resolved, argv);
+	self_pipe_send(selfPipe, errno);
+	_exit(1);
+}
+
+LINKAGE_PRIVATE int zygote_clone(char* resolved, char** argv, int fds[REQUEST_FDS], pid_t* pid) {
+	int selfPipe[2];
+	int ret;
+	transparent_return(self_pipe_new(selfPipe));
+	// The child's parent is the shell, which waits on it like any command it forked itself
+	if ((*pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL)) == 0) {
+		zygote_exec(resolved, argv, fds, selfPipe);
+	} else if (*pid == FAIL_COND) {
+		ret = errno;
+		close(selfPipe[READ_PORT]);
+		close(selfPipe[WRITE_PORT]);
+		return ret;
+	}
+	int err = 0;
+	// Await error byte or close-on-exec
+	if (self_pipe_poll(selfPipe, &err) <= 0) {
+		err = 0;
+	}
+	self_pipe_free(selfPipe);
+	return err;
+}
+
+// 0: argv holds the arguments, Otherwise: EPROTO
+LINKAGE_PRIVATE int unpack_request(char* message, size_t size, char** resolved, char*** argv) {
+	ZygoteRequest request;
+	if (size < sizeof(request)) {
+		return EPROTO;
+	}
+	memcpy(&request, message, sizeof(request));
+	char* strings = message + sizeof(request);
+	char* end = strings + request.length;
+	if (request.length != size - sizeof(request) || request.length == 0 || end[-1] != '\0'
+		|| (*argv = malloc((request.argCount + 1) * sizeof(**argv))) == NULL) {
+		return EPROTO;
+	}
+	*resolved = strings;
+	strings += strlen(strings) + 1;
+	for (uint32_t i = 0; i < request.argCount; i++) {
+		if (strings == end) {
+			free(*argv);
+			return EPROTO;
+		}
+		(*argv)[i] = strings;
+		strings += strlen(strings) + 1;
+	}
+	(*argv)[request.argCount] = NULL;
+	return 0;
+}
+
+__attribute__((noreturn))
+LINKAGE_PRIVATE void zygote_main(int sock) {
+	size_t capacity = sizeof(ZygoteRequest) + ZYGOTE_REQUEST_MAX;
+	char* message = malloc(capacity);
+	if (message == NULL) {
+		_exit(1);
+	}
+	for (;;) {
+		RequestControl control;
+		struct iovec iov = { message, capacity };
+		struct msghdr header = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buffer,
+			.msg_controllen = sizeof(control.buffer)
+		};
+		ssize_t size;
+		while ((size = recvmsg(sock, &header, MSG_CMSG_CLOEXEC)) == FAIL_COND && errno == EINTR);
+		if (size <= 0) {
+			// The shell has exited or stopped the zygote
+			_exit(0);
+		}
+		int fds[REQUEST_FDS];
+		size_t fdCount = 0;
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+		if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			fdCount = fdCount < REQUEST_FDS ? fdCount : REQUEST_FDS;
+			memcpy(fds, CMSG_DATA(cmsg), fdCount * sizeof(int));
+		}
+		ZygoteReply reply = { EPROTO, 0 };
+		char* resolved;
+		char** argv;
+		if (fdCount == REQUEST_FDS && !(header.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+			&& unpack_request(message, (size_t) size, &resolved, &argv) == 0) {
+			pid_t pid = 0;
+			reply.err = zygote_clone(resolved, argv, fds, &pid);
+			reply.pid = pid;
+			free(argv);
+		}
+		for (size_t i = 0; i < fdCount; i++) {
+			close(fds[i]);
+		}
+		send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+	}
+}
+
+LINKAGE_PUBLIC int zygote_start() {
+	int pair[2];
+	// Sequenced packets keep each request a single message
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair)) {
+		return errno;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(pair[SHELL_END]);
+		zygote_main(pair[ZYGOTE_END]);
+	} else if (pid == FAIL_COND) {
+		int err = errno;
+		close(pair[SHELL_END]);
+		close(pair[ZYGOTE_END]);
+		return err;
+	}
+	close(pair[ZYGOTE_END]);
+	zygoteFd = pair[SHELL_END];
+	zygotePid = pid;
+	return 0;
+}
+
+LINKAGE_PUBLIC void zygote_detach() {
+	if (zygoteFd != FAIL_COND) {
+		close(zygoteFd);
+	}
+	zygoteFd = FAIL_COND;
+	zygotePid = FAIL_COND;
+}
+
+LINKAGE_PUBLIC void zygote_stop() {
+	if (zygoteFd != FAIL_COND) {
+		// The zygote exits once it reads the end of the stream
+		close(zygoteFd);
+		zygoteFd = FAIL_COND;
+	}
+	if (zygotePid != FAIL_COND) {
+		while (waitpid(zygotePid, NULL, 0) == FAIL_COND && errno == EINTR);
+		zygotePid = FAIL_COND;
+	}
+}
+
+// NULL: Longer than ZYGOTE_REQUEST_MAX or out of memory
+LINKAGE_PRIVATE char* pack_request(char* resolved, Args args, size_t* size) {
+	ZygoteRequest request = { 0, strlen(resolved) + 1 };
+	for (; args[request.argCount] != NULL; request.argCount++) {
+		if ((request.length += strlen(args[request.argCount]) + 1) > ZYGOTE_REQUEST_MAX) {
+			return NULL;
+		}
+	}
+	if (request.length > ZYGOTE_REQUEST_MAX) {
+		return NULL;
+	}
+	*size = sizeof(request) + request.length;
+	char* message = malloc(*size);
+	if (message == NULL) {
+		return NULL;
+	}
+	memcpy(message, &request, sizeof(request));
+	char* strings = stpcpy(message + sizeof(request), resolved) + 1;
+	for (uint32_t i = 0; i < request.argCount; i++) {
+		strings = stpcpy(strings, args[i]) + 1;
+	}
+	return message;
+}
+
+__attribute__((hot))
+LINKAGE_PUBLIC int zygote_spawn(char* resolved, Args args, IO* io, pid_t* pid) {
+	size_t size;
+	char* message;
+	if (zygoteFd == FAIL_COND || (message = pack_request(resolved, args, &size)) == NULL) {
+		return ENOTCONN;
+	}
+	// The shell's cwd at the time of the request, cd may have moved it since the zygote started
+	int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (cwd == FAIL_COND) {
+		free(message);
+		return ENOTCONN;
+	}
+	// stderr as the shell has it now, captured for a background job it is not the zygote's
+	int fds[REQUEST_FDS] = {
+		[REQUEST_IN] = io->in,
+		[REQUEST_OUT] = io->out,
+		[REQUEST_ERR] = STDERR_FILENO,
+		[REQUEST_CWD] = cwd
+	};
+	RequestControl control = { 0 };
+	struct iovec iov = { message, size };
+	struct msghdr header = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer)
+	};
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	ZygoteReply reply;
+	ssize_t count;
+	while ((count = sendmsg(zygoteFd, &header, MSG_NOSIGNAL)) == FAIL_COND && errno == EINTR);
+	if (count != FAIL_COND) {
+		while ((count = recv(zygoteFd, &reply, sizeof(reply), 0)) == FAIL_COND && errno == EINTR);
+	}
+	close(cwd);
+	free(message);
+	if (count != sizeof(reply)) {
+		// The zygote is gone, everything from now on is spawned directly
+		zygote_stop();
+		return ENOTCONN;
+	}
+	*pid = reply.pid;
+	return reply.err;
+}
@@ -0,0 +1,31 @@
+#ifndef ANUBIS_ZYGOTE_H
+#define ANUBIS_ZYGOTE_H
+
+#include <sys/types.h>
+
+#include "spawn.h"
+#include "structure.h"
+
+/* Helper forked at startup (ANUBIS_SPAWN=zygote), while the shell is still
+ * small, that forks and execs commands on its behalf. Requests carry the
+ * resolved path and arguments, with stdin, stdout and the cwd attached as
+ * SCM_RIGHTS descriptors. Children are created with CLONE_PARENT, so they are
+ * the shell's own: waited on, accounted and job controlled as if forked
+ * directly, while fork cost stays that of the zygote however large the shell
+ * grows. If the zygote is unavailable commands are spawned directly.
+ */
+
+// Largest request, longer argument lists are spawned directly
+#define ZYGOTE_REQUEST_MAX (64 * 1024)
+
+// 0: Running, Otherwise: errno, commands are spawned directly
+int zygote_start();
+// Ends the zygote and waits for it, its children are unaffected
+void zygote_stop();
+// A forked shell (e.g. a server session) is not the zygote's parent, its commands are spawned directly
+void zygote_detach();
+
+// ENOTCONN: No zygote or request too large, spawn directly, Otherwise: as spawn_command
+int zygote_spawn(char* resolved, Args args, IO* io, pid_t* pid);
+
+#endif // ANUBIS_ZYGOTE_H